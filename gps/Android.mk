@@ -18,9 +18,40 @@ endif
 ifeq ($(USE_FOXCONN_GPS_HARDWARE),true)
     LOCAL_CFLAGS    += -DHAVE_GPS_HARDWARE
     LOCAL_SRC_FILES += gps/gps_hardware.c
+    LOCAL_SRC_FILES += gps/gps_dev.c
+    LOCAL_SRC_FILES += gps/sirf_binary.c
+    LOCAL_SRC_FILES += gps/gps_logger.c
+    LOCAL_SRC_FILES += gps/gps_cache.c
 endif
 #  guanxiaowei 20100729 end: add this function to find gps_hardware.c
 
+# Replay of recorded NMEA or capture files, used when the gps.replay.file
+# property is set.
+#
+ifeq ($(USE_GPS_REPLAY),true)
+    LOCAL_CFLAGS    += -DHAVE_GPS_REPLAY
+    LOCAL_SRC_FILES += gps/gps_replay.c
+endif
+
+# Callback dispatch, timing metrics, satellite deltas and capture files
+# shared by the serial and replay backends.
+#
+ifneq ($(filter true,$(USE_FOXCONN_GPS_HARDWARE) $(USE_GPS_REPLAY)),)
+    LOCAL_SRC_FILES += gps/gps_dispatch.c
+    LOCAL_SRC_FILES += gps/gps_metrics.c
+    LOCAL_SRC_FILES += gps/gps_sv_delta.c
+    LOCAL_SRC_FILES += gps/gps_capture.c
+    LOCAL_C_INCLUDES       += external/zlib
+    LOCAL_SHARED_LIBRARIES += libz
+endif
+
+# NMEA framing and parsing shared by the serial, emulator and replay backends.
+#
+ifneq ($(filter true,$(USE_QEMU_GPS_HARDWARE) $(USE_FOXCONN_GPS_HARDWARE) $(USE_GPS_REPLAY)),)
+    LOCAL_SRC_FILES += gps/nmea_framer.c
+    LOCAL_SRC_FILES += gps/nmea_parser.c
+endif
+
 
 LOCAL_SRC_FILES += gps/gps.cpp
 
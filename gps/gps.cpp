@@ -18,6 +18,15 @@ static void
 gps_find_hardware( void )
 {
     D("gps_find_hardware IN");
+#ifdef HAVE_GPS_REPLAY
+    /* only takes over when gps.replay.file is set */
+    sGpsInterface = gps_get_replay_interface();
+    if (sGpsInterface) {
+        LOGD("using GPS replay\n");
+        return;
+    }
+#endif
+
 #ifdef HAVE_QEMU_GPS_HARDWARE
     D("using QEMU GPS Hardware");
     if (qemu_check()) {
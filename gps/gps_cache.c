@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define  LOG_TAG  "gps_cache"
+#include <cutils/log.h>
+
+#include "gps_cache.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define  GPS_CACHE_FILE_SIZE  (2 * sizeof(GpsCacheSlot))
+
+static uint32_t
+gps_cache_crc( const GpsCacheEntry*  entry )
+{
+    return crc32( 0, (const Bytef*) entry, sizeof(*entry) );
+}
+
+
+static int
+gps_cache_slot_valid( const GpsCacheSlot*  slot )
+{
+    return slot->magic == GPS_CACHE_MAGIC &&
+           slot->version == GPS_CACHE_VERSION &&
+           slot->size == sizeof(GpsCacheEntry) &&
+           slot->seq != 0 &&
+           slot->crc == gps_cache_crc( &slot->entry );
+}
+
+
+int
+gps_cache_init( GpsCache*  c, const char*  path )
+{
+    struct stat  st;
+    int          i;
+
+    memset( c, 0, sizeof(*c) );
+    c->current = -1;
+
+    c->fd = open( path, O_RDWR|O_CREAT, 0600 );
+    if (c->fd < 0) {
+        LOGE("could not open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    /* a file of another size is from another version, start over */
+    if (fstat( c->fd, &st ) < 0 || st.st_size != (off_t) GPS_CACHE_FILE_SIZE) {
+        if (ftruncate( c->fd, 0 ) < 0 ||
+            ftruncate( c->fd, GPS_CACHE_FILE_SIZE ) < 0) {
+            LOGE("could not size %s: %s", path, strerror(errno));
+            goto Fail;
+        }
+    }
+
+    c->slots = mmap( NULL, GPS_CACHE_FILE_SIZE, PROT_READ|PROT_WRITE,
+                     MAP_SHARED, c->fd, 0 );
+    if (c->slots == MAP_FAILED) {
+        LOGE("could not map %s: %s", path, strerror(errno));
+        c->slots = NULL;
+        goto Fail;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (!gps_cache_slot_valid( &c->slots[i] ))
+            continue;
+        if (c->current < 0 || (int32_t)(c->slots[i].seq - c->seq) > 0) {
+            c->current = i;
+            c->seq     = c->slots[i].seq;
+        }
+    }
+    D("%s: current slot %d, seq %u", path, c->current, c->seq);
+    return 0;
+
+Fail:
+    close( c->fd );
+    c->fd = -1;
+    return -1;
+}
+
+
+void
+gps_cache_done( GpsCache*  c )
+{
+    if (c->slots != NULL)
+        munmap( c->slots, GPS_CACHE_FILE_SIZE );
+    if (c->fd >= 0)
+        close( c->fd );
+    memset( c, 0, sizeof(*c) );
+    c->fd      = -1;
+    c->current = -1;
+}
+
+
+int
+gps_cache_load( GpsCache*  c, GpsCacheEntry*  entry )
+{
+    if (c->slots == NULL || c->current < 0)
+        return -1;
+
+    *entry = c->slots[c->current].entry;
+    return 0;
+}
+
+
+int
+gps_cache_save( GpsCache*  c, GpsCacheEntry*  entry )
+{
+    GpsCacheSlot*  slot;
+    struct timeval tv;
+    int            next;
+
+    if (c->slots == NULL)
+        return -1;
+
+    gettimeofday( &tv, NULL );
+    entry->saved = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+    /* the slot is invalid until its sequence is set, which only happens
+     * once the rest of it is on disk
+     */
+    next = (c->current == 0) ? 1 : 0;
+    slot = &c->slots[next];
+    slot->seq     = 0;
+    slot->magic   = GPS_CACHE_MAGIC;
+    slot->version = GPS_CACHE_VERSION;
+    slot->size    = sizeof(GpsCacheEntry);
+    slot->entry   = *entry;
+    slot->crc     = gps_cache_crc( &slot->entry );
+    if (msync( c->slots, GPS_CACHE_FILE_SIZE, MS_SYNC ) < 0)
+        goto Fail;
+
+    c->seq += 1;
+    if (c->seq == 0)
+        c->seq = 1;
+    slot->seq = c->seq;
+    if (msync( c->slots, GPS_CACHE_FILE_SIZE, MS_SYNC ) < 0)
+        goto Fail;
+
+    c->current = next;
+    D("saved slot %d, seq %u, flags 0x%x", next, c->seq, entry->flags);
+    return 0;
+
+Fail:
+    LOGE("could not sync gps cache: %s", strerror(errno));
+    return -1;
+}
+
+
+void
+gps_cache_set_fix( GpsCacheEntry*  entry, const GpsLocation*  fix, int64_t  rx_time )
+{
+    if (!(fix->flags & GPS_LOCATION_HAS_LAT_LONG))
+        return;
+
+    entry->flags    |= GPS_CACHE_HAS_FIX | GPS_CACHE_HAS_TIME;
+    entry->latitude  = fix->latitude;
+    entry->longitude = fix->longitude;
+    entry->altitude  = (fix->flags & GPS_LOCATION_HAS_ALTITUDE) ? fix->altitude : 0;
+    entry->accuracy  = (fix->flags & GPS_LOCATION_HAS_ACCURACY) ? fix->accuracy : 0;
+    entry->fix_time  = fix->timestamp;
+    entry->time_offset = fix->timestamp - rx_time;
+}
+
+
+void
+gps_cache_set_sv( GpsCacheEntry*  entry, const GpsSvStatus*  sv )
+{
+    int  i;
+
+    if (sv->num_svs == 0)
+        return;
+
+    entry->flags |= GPS_CACHE_HAS_SV;
+    entry->sv_mask = 0;
+    for (i = 0; i < sv->num_svs; i++) {
+        int  prn = sv->sv_list[i].prn;
+        if (prn >= 1 && prn <= 32)
+            entry->sv_mask |= 1u << (prn - 1);
+    }
+    entry->ephemeris_mask   = sv->ephemeris_mask;
+    entry->almanac_mask     = sv->almanac_mask;
+    entry->used_in_fix_mask = sv->used_in_fix_mask;
+}
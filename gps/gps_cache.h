@@ -0,0 +1,96 @@
+#ifndef _gps_cache_h
+#define _gps_cache_h
+
+#include <stdint.h>
+#include <hardware_legacy/gps.h>
+
+/* what the receiver knew at the end of the last session, kept on disk so
+ * that the next one can warm start it. the file is memory-mapped and holds
+ * two slots, each with a sequence number and a crc32. an update writes the
+ * slot that isn't current, syncs it, then bumps its sequence, so a crash
+ * half-way leaves the other slot to load. the file is in host byte order,
+ * it never leaves the device.
+ */
+#define  GPS_CACHE_MAGIC    0x43535047      /* "GPSC" */
+#define  GPS_CACHE_VERSION  1
+
+/* where the cache lives unless the "gps.cache.file" property says otherwise */
+#define  GPS_CACHE_DEFAULT_FILE  "/data/misc/gps/gps.cache"
+
+/* a cached position older than this is too far off to start from */
+#define  GPS_CACHE_MAX_AGE_MS    (12*3600*1000LL)
+
+/* ephemeris the receiver collected is still good this long after a fix */
+#define  GPS_CACHE_EPHEMERIS_MS  (2*3600*1000LL)
+
+/* during a session the cache is written at most this often */
+#define  GPS_CACHE_SAVE_MS       (5*60*1000)
+
+/* what an entry holds */
+enum {
+    GPS_CACHE_HAS_FIX  = (1 << 0),
+    GPS_CACHE_HAS_TIME = (1 << 1),      /* time_offset is valid */
+    GPS_CACHE_HAS_SV   = (1 << 2),
+};
+
+typedef struct {
+    int64_t   saved;            /* system UTC when written, in ms */
+    uint32_t  flags;            /* GPS_CACHE_HAS_XXX */
+    uint32_t  baud;             /* bps the receiver was left at, 0 if unknown */
+    double    latitude;
+    double    longitude;
+    double    altitude;         /* above MSL, 0 if unknown */
+    float     accuracy;         /* in meters, 0 if unknown */
+    float     reserved2;
+    int64_t   fix_time;         /* receiver UTC of the fix, in ms */
+    int64_t   time_offset;      /* receiver UTC minus system UTC, in ms */
+    uint32_t  sv_mask;          /* PRNs in view, bit 0 for PRN 1 */
+    uint32_t  ephemeris_mask;
+    uint32_t  almanac_mask;
+    uint32_t  used_in_fix_mask;
+} GpsCacheEntry;
+
+typedef struct {
+    uint32_t       magic;
+    uint16_t       version;
+    uint16_t       size;        /* sizeof(GpsCacheEntry) */
+    uint32_t       seq;         /* the highest valid one is current */
+    uint32_t       crc;         /* of the entry */
+    GpsCacheEntry  entry;
+} GpsCacheSlot;
+
+typedef struct {
+    int            fd;
+    GpsCacheSlot*  slots;       /* two, mapped from the file */
+    uint32_t       seq;         /* of the current slot, 0 if none */
+    int            current;
+    int64_t        last_save;   /* CLOCK_MONOTONIC, in ms */
+} GpsCache;
+
+/* open or create the cache file, returns -1 if it can't be mapped. a
+ * missing, corrupted or older version file is simply empty.
+ */
+extern int
+gps_cache_init( GpsCache*  c, const char*  path );
+
+extern void
+gps_cache_done( GpsCache*  c );
+
+/* copy the current entry, returns -1 if there is none */
+extern int
+gps_cache_load( GpsCache*  c, GpsCacheEntry*  entry );
+
+/* make 'entry' current, 'saved' is set here */
+extern int
+gps_cache_save( GpsCache*  c, GpsCacheEntry*  entry );
+
+/* fill the fix part of an entry from a fix received at 'rx_time', the
+ * system UTC in ms
+ */
+extern void
+gps_cache_set_fix( GpsCacheEntry*  entry, const GpsLocation*  fix, int64_t  rx_time );
+
+extern void
+gps_cache_set_sv( GpsCacheEntry*  entry, const GpsSvStatus*  sv );
+
+#endif /* _gps_cache_h */
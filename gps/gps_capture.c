@@ -0,0 +1,524 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define  LOG_TAG  "gps_capture"
+#include <cutils/log.h>
+
+#include "gps_capture.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static const char  _capture_magic[8] = GPS_CAPTURE_MAGIC;
+static const char  _index_magic[4]   = { 'G','C','I','X' };
+
+/* a record header is at most two 10-byte varints */
+#define  RECORD_HEADER_MAX  20
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       E N C O D I N G                                 *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static void
+put_u32( unsigned char*  p, uint32_t  v )
+{
+    p[0] = (unsigned char)(v);
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void
+put_u64( unsigned char*  p, uint64_t  v )
+{
+    put_u32( p, (uint32_t)v );
+    put_u32( p+4, (uint32_t)(v >> 32) );
+}
+
+static uint32_t
+get_u32( const unsigned char*  p )
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get_u64( const unsigned char*  p )
+{
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p+4) << 32);
+}
+
+static int
+put_varint( unsigned char*  p, uint64_t  v )
+{
+    int  n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/* returns the number of bytes used, or -1 if the varint is truncated */
+static int
+get_varint( const unsigned char*  p, const unsigned char*  end, uint64_t*  v )
+{
+    uint64_t  result = 0;
+    int       shift  = 0;
+    int       n      = 0;
+
+    while (p + n < end && shift < 64) {
+        unsigned char  c = p[n++];
+        result |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = result;
+            return n;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+
+static int
+write_all( int  fd, const void*  buf, int  len )
+{
+    const char*  p = buf;
+
+    while (len > 0) {
+        int  ret;
+        do {
+            ret = write( fd, p, len );
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret <= 0)
+            return -1;
+        p   += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+
+static int
+read_at( int  fd, uint64_t  offset, void*  buf, int  len )
+{
+    char*  p = buf;
+
+    while (len > 0) {
+        int  ret;
+        do {
+            ret = pread( fd, p, len, (off_t)offset );
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret <= 0)
+            return -1;
+        p      += ret;
+        offset += ret;
+        len    -= ret;
+    }
+    return 0;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       W R I T E R                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+GpsCaptureWriter*
+gps_capture_writer_new( int  fd )
+{
+    GpsCaptureWriter*  w;
+    unsigned char      header[ GPS_CAPTURE_HEADER_SIZE ];
+
+    w = calloc( 1, sizeof(*w) );
+    if (w == NULL) {
+        close( fd );
+        return NULL;
+    }
+    w->fd = fd;
+
+    memcpy( header, _capture_magic, 8 );
+    put_u32( header+8,  GPS_CAPTURE_VERSION );
+    put_u32( header+12, GPS_CAPTURE_BLOCK_SIZE );
+    if (write_all( fd, header, sizeof(header) ) < 0) {
+        LOGE("could not write capture header: %s", strerror(errno));
+        close( fd );
+        free( w );
+        return NULL;
+    }
+    w->offset = sizeof(header);
+    return w;
+}
+
+
+int
+gps_capture_writer_flush( GpsCaptureWriter*  w )
+{
+    unsigned char*  out;
+    uLongf          out_len;
+    int             ret;
+
+    if (w->block_count == 0)
+        return 0;
+
+    out_len = compressBound( w->raw_len );
+    out     = malloc( GPS_CAPTURE_BLOCK_HEADER_SIZE + out_len );
+    if (out == NULL)
+        return -1;
+
+    if (compress2( out + GPS_CAPTURE_BLOCK_HEADER_SIZE, &out_len,
+                   w->raw, w->raw_len, Z_DEFAULT_COMPRESSION ) != Z_OK) {
+        LOGE("could not compress capture block");
+        free( out );
+        return -1;
+    }
+    put_u32( out,    w->raw_len );
+    put_u32( out+4,  (uint32_t)out_len );
+    put_u64( out+8,  w->block_time );
+    put_u32( out+16, w->block_count );
+
+    if (w->index_count == w->index_max) {
+        int               max   = w->index_max ? 2*w->index_max : 64;
+        GpsCaptureIndex*  index = realloc( w->index, max * sizeof(*index) );
+        if (index != NULL) {
+            w->index     = index;
+            w->index_max = max;
+        }
+    }
+    /* without room for the entry the index is dropped, the file can
+     * still be read sequentially
+     */
+    if (w->index_count < w->index_max) {
+        w->index[w->index_count].offset  = w->offset;
+        w->index[w->index_count].time_us = w->block_time;
+        w->index[w->index_count].count   = w->block_count;
+        w->index_count += 1;
+    }
+
+    ret = write_all( w->fd, out, GPS_CAPTURE_BLOCK_HEADER_SIZE + out_len );
+    free( out );
+    if (ret < 0) {
+        LOGE("could not write capture block: %s", strerror(errno));
+        return -1;
+    }
+    D("block of %d records, %d -> %d bytes", w->block_count, w->raw_len, (int)out_len);
+
+    w->offset     += GPS_CAPTURE_BLOCK_HEADER_SIZE + out_len;
+    w->raw_len     = 0;
+    w->block_count = 0;
+    return 0;
+}
+
+
+int
+gps_capture_writer_add( GpsCaptureWriter*  w, uint64_t  time_us, const void*  data, int  len )
+{
+    unsigned char  header[ RECORD_HEADER_MAX ];
+    int            n;
+
+    if (len > GPS_CAPTURE_MAX_RECORD)
+        len = GPS_CAPTURE_MAX_RECORD;
+
+    if (w->block_count > 0 &&
+        w->raw_len + RECORD_HEADER_MAX + len > GPS_CAPTURE_BLOCK_SIZE) {
+        if (gps_capture_writer_flush( w ) < 0)
+            return -1;
+    }
+    if (w->block_count == 0) {
+        w->block_time = time_us;
+        w->last_time  = time_us;
+    }
+    /* the clock is monotonic, but don't trust callers blindly */
+    if (time_us < w->last_time)
+        time_us = w->last_time;
+
+    n  = put_varint( header, time_us - w->last_time );
+    n += put_varint( header + n, (uint64_t)len );
+    memcpy( w->raw + w->raw_len, header, n );
+    memcpy( w->raw + w->raw_len + n, data, len );
+    w->raw_len     += n + len;
+    w->block_count += 1;
+    w->last_time    = time_us;
+    return 0;
+}
+
+
+void
+gps_capture_writer_free( GpsCaptureWriter*  w )
+{
+    if (w == NULL)
+        return;
+
+    if (gps_capture_writer_flush( w ) == 0) {
+        int             size = w->index_count * GPS_CAPTURE_INDEX_ENTRY_SIZE + GPS_CAPTURE_TRAILER_SIZE;
+        unsigned char*  buf  = malloc( size );
+
+        if (buf != NULL) {
+            unsigned char*  p = buf;
+            int             nn;
+
+            for (nn = 0; nn < w->index_count; nn++, p += GPS_CAPTURE_INDEX_ENTRY_SIZE) {
+                put_u64( p,    w->index[nn].offset );
+                put_u64( p+8,  w->index[nn].time_us );
+                put_u32( p+16, w->index[nn].count );
+            }
+            put_u64( p,   w->offset );
+            put_u32( p+8, w->index_count );
+            memcpy( p+12, _index_magic, 4 );
+
+            if (write_all( w->fd, buf, size ) < 0)
+                LOGE("could not write capture index: %s", strerror(errno));
+            free( buf );
+        }
+    }
+    close( w->fd );
+    free( w->index );
+    free( w );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E A D E R                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static void
+gps_capture_reader_load_index( GpsCaptureReader*  r, uint64_t  size )
+{
+    unsigned char   trailer[ GPS_CAPTURE_TRAILER_SIZE ];
+    unsigned char*  buf;
+    uint64_t        offset;
+    uint32_t        count;
+    uint32_t        nn;
+
+    if (size < GPS_CAPTURE_HEADER_SIZE + GPS_CAPTURE_TRAILER_SIZE ||
+        read_at( r->fd, size - sizeof(trailer), trailer, sizeof(trailer) ) < 0 ||
+        memcmp( trailer+12, _index_magic, 4 ) != 0)
+        return;
+
+    offset = get_u64( trailer );
+    count  = get_u32( trailer+8 );
+    if (count == 0 ||
+        offset + (uint64_t)count * GPS_CAPTURE_INDEX_ENTRY_SIZE + sizeof(trailer) != size)
+        return;
+
+    buf      = malloc( count * GPS_CAPTURE_INDEX_ENTRY_SIZE );
+    r->index = malloc( count * sizeof(*r->index) );
+    if (buf == NULL || r->index == NULL ||
+        read_at( r->fd, offset, buf, count * GPS_CAPTURE_INDEX_ENTRY_SIZE ) < 0) {
+        free( buf );
+        free( r->index );
+        r->index = NULL;
+        return;
+    }
+    for (nn = 0; nn < count; nn++) {
+        const unsigned char*  p = buf + nn * GPS_CAPTURE_INDEX_ENTRY_SIZE;
+        r->index[nn].offset  = get_u64( p );
+        r->index[nn].time_us = get_u64( p+8 );
+        r->index[nn].count   = get_u32( p+16 );
+    }
+    r->index_count = count;
+    r->blocks_end  = offset;
+    free( buf );
+}
+
+
+GpsCaptureReader*
+gps_capture_reader_open( const char*  path )
+{
+    GpsCaptureReader*  r;
+    unsigned char      header[ GPS_CAPTURE_HEADER_SIZE ];
+    off_t              size;
+    int                fd;
+
+    fd = open( path, O_RDONLY );
+    if (fd < 0) {
+        LOGE("could not open capture %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (read_at( fd, 0, header, sizeof(header) ) < 0 ||
+        memcmp( header, _capture_magic, 8 ) != 0 ||
+        get_u32( header+8 ) != GPS_CAPTURE_VERSION) {
+        LOGE("%s is not a GPS capture", path);
+        close( fd );
+        return NULL;
+    }
+
+    r = calloc( 1, sizeof(*r) );
+    if (r == NULL) {
+        close( fd );
+        return NULL;
+    }
+    r->fd         = fd;
+    r->next_block = GPS_CAPTURE_HEADER_SIZE;
+
+    size = lseek( fd, 0, SEEK_END );
+    r->blocks_end = (size > 0) ? (uint64_t)size : 0;
+    if (size > 0)
+        gps_capture_reader_load_index( r, (uint64_t)size );
+    D("%s: %d blocks in index", path, r->index_count);
+    return r;
+}
+
+
+void
+gps_capture_reader_close( GpsCaptureReader*  r )
+{
+    if (r == NULL)
+        return;
+    close( r->fd );
+    free( r->index );
+    free( r );
+}
+
+
+/* load the block at r->next_block, returns 0 at the end of the capture */
+static int
+gps_capture_reader_load_block( GpsCaptureReader*  r )
+{
+    unsigned char   header[ GPS_CAPTURE_BLOCK_HEADER_SIZE ];
+    unsigned char*  comp;
+    uint32_t        raw_len, comp_len;
+    uLongf          out_len;
+    int             ret;
+
+    if (r->next_block + sizeof(header) > r->blocks_end ||
+        read_at( r->fd, r->next_block, header, sizeof(header) ) < 0)
+        return 0;
+
+    raw_len  = get_u32( header );
+    comp_len = get_u32( header+4 );
+    if (raw_len > GPS_CAPTURE_BLOCK_SIZE ||
+        r->next_block + sizeof(header) + comp_len > r->blocks_end) {
+        /* a block cut short by a crash */
+        return 0;
+    }
+
+    comp = malloc( comp_len );
+    if (comp == NULL)
+        return -1;
+    if (read_at( r->fd, r->next_block + sizeof(header), comp, comp_len ) < 0) {
+        free( comp );
+        return 0;
+    }
+    out_len = GPS_CAPTURE_BLOCK_SIZE;
+    ret = uncompress( r->raw, &out_len, comp, comp_len );
+    free( comp );
+    if (ret != Z_OK || out_len != raw_len) {
+        LOGE("corrupted capture block at %llu", (unsigned long long)r->next_block);
+        return -1;
+    }
+
+    r->raw_len     = raw_len;
+    r->raw_pos     = 0;
+    r->time_us     = get_u64( header+8 );
+    r->remaining   = get_u32( header+16 );
+    r->next_block += sizeof(header) + comp_len;
+    return 1;
+}
+
+
+int
+gps_capture_reader_next( GpsCaptureReader*  r, uint64_t*  time_us,
+                         const char**  data, int*  len )
+{
+    const unsigned char*  p;
+    const unsigned char*  end;
+    uint64_t              delta, size;
+    int                   n, m;
+
+    while (r->remaining == 0) {
+        int  ret = gps_capture_reader_load_block( r );
+        if (ret <= 0)
+            return ret;
+    }
+
+    p   = r->raw + r->raw_pos;
+    end = r->raw + r->raw_len;
+    n   = get_varint( p, end, &delta );
+    if (n < 0)
+        return -1;
+    m   = get_varint( p + n, end, &size );
+    if (m < 0 || size > (uint64_t)(end - (p + n + m)))
+        return -1;
+
+    r->time_us   += delta;
+    r->raw_pos   += n + m + (int)size;
+    r->remaining -= 1;
+
+    *time_us = r->time_us;
+    *data    = (const char*)(p + n + m);
+    *len     = (int)size;
+    return 1;
+}
+
+
+int
+gps_capture_reader_seek( GpsCaptureReader*  r, uint64_t  time_us )
+{
+    r->next_block = GPS_CAPTURE_HEADER_SIZE;
+    r->remaining  = 0;
+
+    /* start from the last block that begins at or before 'time_us' */
+    if (r->index != NULL) {
+        int  lo = 0, hi = r->index_count - 1;
+
+        while (lo < hi) {
+            int  mid = (lo + hi + 1) / 2;
+            if (r->index[mid].time_us <= time_us)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        r->next_block = r->index[lo].offset;
+    }
+
+    for (;;) {
+        unsigned char*  save_pos;
+        uint64_t        save_time, t;
+        uint32_t        save_remaining;
+        const char*     data;
+        int             len, ret;
+
+        /* peek at the next record, and step back if it is the one */
+        if (r->remaining == 0) {
+            ret = gps_capture_reader_load_block( r );
+            if (ret <= 0)
+                return ret;
+        }
+        save_pos       = r->raw + r->raw_pos;
+        save_time      = r->time_us;
+        save_remaining = r->remaining;
+
+        ret = gps_capture_reader_next( r, &t, &data, &len );
+        if (ret <= 0)
+            return ret;
+        if (t >= time_us) {
+            r->raw_pos   = save_pos - r->raw;
+            r->time_us   = save_time;
+            r->remaining = save_remaining;
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef _gps_capture_h
+#define _gps_capture_h
+
+#include <stdint.h>
+
+/* capture files record every chunk read from the receiver together with
+ * its CLOCK_MONOTONIC arrival time, so that a session can be replayed with
+ * its original timing. all integers are little-endian.
+ *
+ *   header      "GPSCAP\r\n", u32 version, u32 block size
+ *   blocks      u32 raw length, u32 compressed length, u64 time of the
+ *               first record in us, u32 record count, then the records
+ *               compressed with zlib
+ *   index       one entry per block: u64 file offset, u64 time in us,
+ *               u32 record count
+ *   trailer     u64 index offset, u32 index entries, "GCIX"
+ *
+ * a record is a varint time delta in us from the previous record of the
+ * block (0 for the first one), a varint length, then the data. the index
+ * is written when the file is closed, files cut short by a crash can still
+ * be read sequentially.
+ */
+#define  GPS_CAPTURE_MAGIC       "GPSCAP\r\n"
+#define  GPS_CAPTURE_VERSION     1
+
+/* uncompressed size of a block */
+#define  GPS_CAPTURE_BLOCK_SIZE  (64*1024)
+
+/* largest chunk that can be recorded */
+#define  GPS_CAPTURE_MAX_RECORD  4096
+
+#define  GPS_CAPTURE_HEADER_SIZE        16
+#define  GPS_CAPTURE_BLOCK_HEADER_SIZE  20
+#define  GPS_CAPTURE_INDEX_ENTRY_SIZE   20
+#define  GPS_CAPTURE_TRAILER_SIZE       16
+
+typedef struct {
+    uint64_t  offset;
+    uint64_t  time_us;
+    uint32_t  count;
+} GpsCaptureIndex;
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       W R I T E R                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+typedef struct {
+    int               fd;
+    uint64_t          offset;       /* bytes written so far */
+    uint64_t          block_time;   /* time of the block's first record */
+    uint64_t          last_time;    /* time of the previous record */
+    uint32_t          block_count;  /* records in the current block */
+    int               raw_len;
+    GpsCaptureIndex*  index;
+    int               index_count;
+    int               index_max;
+    unsigned char     raw[ GPS_CAPTURE_BLOCK_SIZE ];
+} GpsCaptureWriter;
+
+/* takes ownership of 'fd' and writes the file header, returns NULL on
+ * error. the writer is too large for the stack, it is allocated here.
+ */
+extern GpsCaptureWriter*
+gps_capture_writer_new( int  fd );
+
+/* returns 0 on success, -1 on I/O error */
+extern int
+gps_capture_writer_add( GpsCaptureWriter*  w, uint64_t  time_us, const void*  data, int  len );
+
+/* end the current block, so that everything added so far is on disk */
+extern int
+gps_capture_writer_flush( GpsCaptureWriter*  w );
+
+/* flush, write the index and close the file */
+extern void
+gps_capture_writer_free( GpsCaptureWriter*  w );
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E A D E R                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+typedef struct {
+    int               fd;
+    GpsCaptureIndex*  index;        /* NULL if the file has no index */
+    int               index_count;
+    uint64_t          blocks_end;   /* where the index, or the file, starts */
+    uint64_t          next_block;   /* file offset of the next block */
+    uint64_t          time_us;      /* time of the last record returned */
+    uint32_t          remaining;    /* records left in the current block */
+    int               raw_len;
+    int               raw_pos;
+    unsigned char     raw[ GPS_CAPTURE_BLOCK_SIZE ];
+} GpsCaptureReader;
+
+/* returns NULL if the file can't be opened or isn't a capture */
+extern GpsCaptureReader*
+gps_capture_reader_open( const char*  path );
+
+extern void
+gps_capture_reader_close( GpsCaptureReader*  r );
+
+/* position the reader on the first record at or after 'time_us', using
+ * the index when there is one. returns -1 on error.
+ */
+extern int
+gps_capture_reader_seek( GpsCaptureReader*  r, uint64_t  time_us );
+
+/* get the next record, which stays valid until the next call. returns 1
+ * on success, 0 at the end of the capture and -1 on error.
+ */
+extern int
+gps_capture_reader_next( GpsCaptureReader*  r, uint64_t*  time_us,
+                         const char**  data, int*  len );
+
+#endif /* _gps_capture_h */
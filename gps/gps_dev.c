@@ -0,0 +1,537 @@
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_dev"
+#include <cutils/log.h>
+
+#include "gps_dev.h"
+#include "nmea_framer.h"
+#include "nmea_parser.h"
+#include "sirf_binary.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+/* 1980-01-06, the GPS epoch, in ms since the UTC one */
+#define  GPS_EPOCH_MS  315964800000LL
+#define  GPS_WEEK_MS   604800000LL
+
+/* the receiver applies a $PSRF100 after the current output, give it time
+ * to switch before listening at the new rate
+ */
+#define  GPS_DEV_SWITCH_MS  200
+
+static const struct {
+    speed_t  speed;
+    int      bps;
+} _bauds[] = {
+    { B4800,  4800  },
+    { B9600,  9600  },
+    { B19200, 19200 },
+    { B38400, 38400 },
+    { B57600, 57600 },
+};
+
+#define  NUM_BAUDS  (int)(sizeof(_bauds)/sizeof(_bauds[0]))
+
+static int
+baud_to_bps( speed_t  speed )
+{
+    int  nn;
+
+    for (nn = 0; nn < NUM_BAUDS; nn++)
+        if (_bauds[nn].speed == speed)
+            return _bauds[nn].bps;
+    return 0;
+}
+
+
+static long long
+now_ms( void )
+{
+    struct timespec  ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       S E R I A L   P O R T                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static int
+gps_dev_set_speed( GpsDev*  dev, speed_t  speed )
+{
+    struct termios  tio;
+
+    if (tcgetattr( dev->fd, &tio ) < 0)
+        return -1;
+    cfsetispeed( &tio, speed );
+    cfsetospeed( &tio, speed );
+    if (tcsetattr( dev->fd, TCSANOW, &tio ) < 0) {
+        LOGE("could not set serial speed: %s", strerror(errno));
+        return -1;
+    }
+    /* whatever was received at the old rate is garbage now */
+    tcflush( dev->fd, TCIFLUSH );
+    dev->baud = speed;
+    return 0;
+}
+
+
+/* the port is non-blocking */
+static int
+gps_dev_write( GpsDev*  dev, const void*  buf, int  len )
+{
+    const char*  msg = buf;
+    int          pos;
+
+    for (pos = 0; pos < len; ) {
+        int  ret = write( dev->fd, msg + pos, len - pos );
+
+        if (ret > 0) {
+            pos += ret;
+        } else if (ret < 0 && errno == EAGAIN) {
+            struct pollfd  pfd = { dev->fd, POLLOUT, 0 };
+            if (poll( &pfd, 1, 100 ) <= 0)
+                return -1;
+        } else if (ret < 0 && errno != EINTR) {
+            LOGE("could not write to receiver: %s", strerror(errno));
+            return -1;
+        }
+    }
+    tcdrain( dev->fd );
+    return 0;
+}
+
+
+/* send '$<body>*hh<CR><LF>' */
+static int
+gps_dev_send( GpsDev*  dev, const char*  format, ... )
+{
+    char      msg[96];
+    va_list   args;
+    int       len, n;
+    unsigned  sum = 0;
+
+    va_start( args, format );
+    len = vsnprintf( msg+1, sizeof(msg)-6, format, args );
+    va_end( args );
+    if (len < 0 || len >= (int)sizeof(msg)-6)
+        return -1;
+
+    for (n = 1; n <= len; n++)
+        sum ^= (unsigned char)msg[n];
+    msg[0] = '$';
+    len += 1;
+    len += snprintf( msg+len, sizeof(msg)-len, "*%02X\r\n", sum );
+    D("sending %.*s", len-2, msg);
+    return gps_dev_write( dev, msg, len );
+}
+
+
+/* send a SiRF binary message */
+static int
+gps_dev_send_binary( GpsDev*  dev, const unsigned char*  payload, int  len )
+{
+    unsigned char  frame[64];
+
+    len = sirf_encode( frame, sizeof(frame), payload, len );
+    if (len < 0)
+        return -1;
+    D("sending binary message %d", payload[0]);
+    return gps_dev_write( dev, frame, len );
+}
+
+
+static void
+gps_dev_probe_sentence( void*  opaque, const char*  p, const char*  end )
+{
+    NmeaTokenizer  tzer[1];
+
+    /* a sentence with a good checksum doesn't happen at the wrong rate */
+    if (p[0] == '$' && nmea_tokenizer_init_checked( tzer, p, end, NMEA_CHECKSUM_REQUIRE ) > 1)
+        *(int*)opaque |= GPS_DEV_NMEA;
+}
+
+
+/* returns the protocol of the first valid sentence or frame received
+ * within 'timeout' ms, 0 if there was none
+ */
+static int
+gps_dev_listen( GpsDev*  dev, int  timeout )
+{
+    NmeaFramer  framer[1];
+    SirfReader  sirf[1];
+    long long   deadline = now_ms() + timeout;
+    int         found = 0;
+
+    nmea_framer_init( framer, gps_dev_probe_sentence, &found );
+    sirf_reader_init( sirf );
+
+    while (!found) {
+        struct pollfd  pfd = { dev->fd, POLLIN, 0 };
+        long long      left = deadline - now_ms();
+        char           buf[256];
+        int            ret;
+
+        if (left <= 0)
+            break;
+        if (poll( &pfd, 1, (int)left ) <= 0)
+            continue;
+
+        ret = read( dev->fd, buf, sizeof(buf) );
+        if (ret > 0) {
+            nmea_framer_feed( framer, buf, ret );
+            sirf_reader_feed( sirf, buf, ret );
+            if (sirf->stats.frames > 0)
+                found |= GPS_DEV_SIRF;
+        }
+    }
+    return found;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E C E I V E R   C O N T R O L                 *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* $PSRF100: switch the port to NMEA at 'speed', 8N1 */
+static int
+gps_dev_switch_baud( GpsDev*  dev, speed_t  speed )
+{
+    if (gps_dev_send( dev, "PSRF100,1,%d,8,1,0", baud_to_bps(speed) ) < 0)
+        return -1;
+    usleep( GPS_DEV_SWITCH_MS * 1000 );
+    if (gps_dev_set_speed( dev, speed ) < 0)
+        return -1;
+    if (!(gps_dev_listen( dev, GPS_DEV_PROBE_MS ) & GPS_DEV_NMEA)) {
+        D("receiver did not come back at %d bps", baud_to_bps(speed));
+        return -1;
+    }
+    return 0;
+}
+
+
+/* SiRF MID 129: back to NMEA at 'speed' with the default sentences at 1 Hz */
+static int
+gps_dev_switch_nmea( GpsDev*  dev, speed_t  speed )
+{
+    static const unsigned  rates[10] = { 1, 1, 1, 1, 1, 1, 0, 0, 0, 0 };
+    unsigned char          msg[24];
+    int                    bps = baud_to_bps(speed);
+    int                    nn;
+
+    msg[0] = SIRF_MID_SWITCH_NMEA;
+    msg[1] = 2;                         /* leave the debug messages alone */
+    for (nn = 0; nn < 10; nn++) {       /* GGA GLL GSA GSV RMC VTG MSS EPE ZDA - */
+        msg[2 + nn*2] = rates[nn];
+        msg[3 + nn*2] = 1;              /* with checksums */
+    }
+    msg[22] = bps >> 8;
+    msg[23] = bps & 0xFF;
+
+    if (gps_dev_send_binary( dev, msg, sizeof(msg) ) < 0)
+        return -1;
+    usleep( GPS_DEV_SWITCH_MS * 1000 );
+    if (gps_dev_set_speed( dev, speed ) < 0)
+        return -1;
+
+    dev->protocol  = GPS_DEV_NMEA;
+    dev->rate      = GPS_DEV_HIGH_UPDATE_RATE;
+    dev->sentences = GPS_DEV_DEFAULT_SENTENCES;
+    return 0;
+}
+
+
+/* SiRF MID 166: output message 'mid' every 'rate' seconds, or all of
+ * them when 'mid' is 0. the mode byte is 0 for one message and 2 for all
+ * messages. 3 would only cover the default navigation messages, MID 2
+ * and 4, and 4 the debug messages.
+ */
+static void
+gps_dev_set_binary_rate( GpsDev*  dev, int  mid, int  rate )
+{
+    unsigned char  msg[8];
+
+    memset( msg, 0, sizeof(msg) );
+    msg[0] = SIRF_MID_SET_RATE;
+    msg[1] = mid ? 0 : 2;
+    msg[2] = mid;
+    msg[3] = rate;
+    gps_dev_send_binary( dev, msg, sizeof(msg) );
+}
+
+
+/* $PSRF103: output 'sentences' every 'rate' seconds and turn the other
+ * ones off. until the rate is known every message is sent.
+ */
+static void
+gps_dev_set_output( GpsDev*  dev, int  rate, unsigned  sentences )
+{
+    unsigned  all = GPS_DEV_DEFAULT_SENTENCES | GPS_DEV_ZDA;
+    int       msg;
+
+    /* in binary mode the fix comes from MID 41, satellites from MID 4 */
+    if (dev->protocol == GPS_DEV_SIRF) {
+        int  old_nav = (dev->sentences & ~GPS_DEV_GSV) ? dev->rate : 0;
+        int  old_trk = (dev->sentences & GPS_DEV_GSV) ? dev->rate : 0;
+        int  nav     = (sentences & ~GPS_DEV_GSV) ? rate : 0;
+        int  trk     = (sentences & GPS_DEV_GSV) ? rate : 0;
+
+        if (dev->rate == 0)
+            gps_dev_set_binary_rate( dev, 0, 0 );
+        if (dev->rate == 0 || nav != old_nav)
+            gps_dev_set_binary_rate( dev, SIRF_MID_GEODETIC, nav );
+        if (dev->rate == 0 || trk != old_trk)
+            gps_dev_set_binary_rate( dev, SIRF_MID_TRACKER, trk );
+        dev->rate      = rate;
+        dev->sentences = sentences;
+        return;
+    }
+
+    for (msg = 0; msg <= 8; msg++) {
+        unsigned  bit = 1u << msg;
+        int       old = (dev->sentences & bit) ? dev->rate : 0;
+        int       new = (sentences & bit) ? rate : 0;
+
+        if (!(all & bit))
+            continue;
+        if (dev->rate == 0 || new != old)
+            gps_dev_send( dev, "PSRF103,%02d,00,%02d,01", msg, new );
+    }
+    dev->rate      = rate;
+    dev->sentences = sentences;
+    D("receiver output 0x%x every %d s", sentences, rate);
+}
+
+
+static void
+gps_dev_set_rate( GpsDev*  dev, int  rate )
+{
+    gps_dev_set_output( dev, rate, dev->sentences );
+}
+
+
+int
+gps_dev_init( GpsDev*  dev, int  fd, int  bps )
+{
+    int  round, k, nn = 0, seen = 0, hint = -1;
+
+    memset( dev, 0, sizeof(*dev) );
+    dev->fd        = fd;
+    dev->protocol  = GPS_DEV_NMEA;
+    dev->sentences = GPS_DEV_DEFAULT_SENTENCES;
+
+    for (k = 0; k < NUM_BAUDS; k++)
+        if (_bauds[k].bps == bps)
+            hint = k;
+
+    /* the receiver may still be at the rate of a previous session, and
+     * needs a moment after power-on before it says anything. the rate it
+     * was left at comes first, then the others in order.
+     */
+    for (round = 0; round < 2; round++) {
+        for (k = 0; k < NUM_BAUDS; k++) {
+            if (hint < 0)
+                nn = k;
+            else
+                nn = (k == 0) ? hint : (k <= hint) ? k - 1 : k;
+            if (gps_dev_set_speed( dev, _bauds[nn].speed ) == 0 &&
+                (seen = gps_dev_listen( dev, GPS_DEV_PROBE_MS )) != 0)
+                goto Found;
+        }
+    }
+    LOGE("no answer from the receiver at any baud rate");
+    gps_dev_set_speed( dev, GPS_DEV_DEFAULT_BAUD );
+    return -1;
+
+Found:
+    LOGD("receiver found at %d bps%s", _bauds[nn].bps,
+         (seen & GPS_DEV_SIRF) ? " in binary mode" : "");
+
+    /* left in binary mode by a previous session, the baud rate is
+     * changed in NMEA mode
+     */
+    if (seen == GPS_DEV_SIRF)
+        gps_dev_switch_nmea( dev, dev->baud );
+
+    if (dev->baud != GPS_DEV_HIGH_BAUD) {
+        speed_t  found = dev->baud;
+
+        if (gps_dev_switch_baud( dev, GPS_DEV_HIGH_BAUD ) < 0 &&
+            gps_dev_switch_baud( dev, GPS_DEV_LOW_BAUD ) < 0) {
+            LOGE("could not switch the receiver's baud rate");
+            gps_dev_set_speed( dev, found );
+        }
+        LOGD("receiver at %d bps", baud_to_bps(dev->baud));
+    }
+    return 0;
+}
+
+
+void
+gps_dev_deinit( GpsDev*  dev )
+{
+    if (dev->protocol == GPS_DEV_SIRF) {
+        gps_dev_switch_nmea( dev, GPS_DEV_DEFAULT_BAUD );
+        return;
+    }
+    gps_dev_set_output( dev, GPS_DEV_HIGH_UPDATE_RATE, GPS_DEV_DEFAULT_SENTENCES );
+    if (dev->baud != GPS_DEV_DEFAULT_BAUD &&
+        gps_dev_send( dev, "PSRF100,1,%d,8,1,0", baud_to_bps(GPS_DEV_DEFAULT_BAUD) ) == 0) {
+        usleep( GPS_DEV_SWITCH_MS * 1000 );
+        gps_dev_set_speed( dev, GPS_DEV_DEFAULT_BAUD );
+    }
+}
+
+
+int
+gps_dev_bps( const GpsDev*  dev )
+{
+    return baud_to_bps( dev->baud );
+}
+
+
+int
+gps_dev_resume( GpsDev*  dev )
+{
+    int  seen;
+
+    tcflush( dev->fd, TCIFLUSH );
+    seen = gps_dev_listen( dev, GPS_DEV_PROBE_MS );
+    if (seen & dev->protocol)
+        return 0;
+
+    LOGD("receiver not back at %d bps, probing", baud_to_bps(dev->baud));
+    return -1;
+}
+
+
+void
+gps_dev_start( GpsDev*  dev, int  fix_interval )
+{
+    int  rate = fix_interval / 1000;
+
+    if (rate < GPS_DEV_HIGH_UPDATE_RATE)
+        rate = GPS_DEV_HIGH_UPDATE_RATE;
+    if (rate > GPS_DEV_SLOW_UPDATE_RATE)
+        rate = GPS_DEV_SLOW_UPDATE_RATE;
+    gps_dev_set_rate( dev, rate );
+}
+
+
+void
+gps_dev_stop( GpsDev*  dev )
+{
+    gps_dev_set_rate( dev, GPS_DEV_SLOW_UPDATE_RATE );
+}
+
+
+void
+gps_dev_set_sentences( GpsDev*  dev, unsigned  sentences )
+{
+    gps_dev_set_output( dev, dev->rate ? dev->rate : GPS_DEV_HIGH_UPDATE_RATE, sentences );
+}
+
+
+int
+gps_dev_set_protocol( GpsDev*  dev, int  protocol )
+{
+    if (protocol == dev->protocol)
+        return 0;
+
+    if (protocol == GPS_DEV_NMEA)
+        return gps_dev_switch_nmea( dev, dev->baud );
+
+    /* $PSRF100 with protocol 0 selects SiRF binary at the same rate */
+    if (gps_dev_send( dev, "PSRF100,0,%d,8,1,0", baud_to_bps(dev->baud) ) < 0)
+        return -1;
+    usleep( GPS_DEV_SWITCH_MS * 1000 );
+    tcflush( dev->fd, TCIFLUSH );
+
+    if (!(gps_dev_listen( dev, GPS_DEV_PROBE_MS ) & GPS_DEV_SIRF)) {
+        LOGD("receiver does not support SiRF binary, staying with NMEA");
+        return -1;
+    }
+    dev->protocol = GPS_DEV_SIRF;
+    dev->rate     = 0;      /* unknown, set everything again */
+    LOGD("receiver switched to SiRF binary");
+    return 0;
+}
+
+
+int
+gps_dev_inject( GpsDev*  dev, double  latitude, double  longitude, double  altitude,
+                GpsUtcTime  utc )
+{
+    long long  gps  = utc - GPS_EPOCH_MS + GPS_DEV_LEAP_SECONDS * 1000LL;
+    int        week = (int)(gps / GPS_WEEK_MS);
+    long long  tow  = gps % GPS_WEEK_MS;      /* in ms */
+
+    if (gps < 0)
+        return -1;
+
+    D("injecting %.4f %.4f week %d tow %lld ms", latitude, longitude, week, tow);
+
+    if (dev->protocol == GPS_DEV_SIRF) {
+        /* MID 128 wants the position in WGS84 ECEF */
+        const double   a  = 6378137.0;
+        const double   e2 = 6.69437999014e-3;
+        double         lat = latitude * M_PI / 180.;
+        double         lon = longitude * M_PI / 180.;
+        double         n   = a / sqrt( 1. - e2 * sin(lat) * sin(lat) );
+        int32_t        xyz[3];
+        unsigned char  msg[25];
+        int            nn;
+
+        xyz[0] = (int32_t)((n + altitude) * cos(lat) * cos(lon));
+        xyz[1] = (int32_t)((n + altitude) * cos(lat) * sin(lon));
+        xyz[2] = (int32_t)((n * (1. - e2) + altitude) * sin(lat));
+
+        memset( msg, 0, sizeof(msg) );
+        msg[0] = SIRF_MID_INIT;
+        for (nn = 0; nn < 3; nn++) {
+            uint32_t  v = (uint32_t)xyz[nn];
+            msg[1 + nn*4] = v >> 24;
+            msg[2 + nn*4] = v >> 16;
+            msg[3 + nn*4] = v >> 8;
+            msg[4 + nn*4] = v;
+        }
+        /* clock drift 0 keeps the last known value, TOW is in 1/100 s */
+        tow /= 10;
+        msg[17] = tow >> 24;
+        msg[18] = tow >> 16;
+        msg[19] = tow >> 8;
+        msg[20] = tow;
+        msg[21] = week >> 8;
+        msg[22] = week;
+        msg[23] = 12;                   /* channels */
+        msg[24] = 0x01;                 /* the data above is valid, clear nothing */
+        return gps_dev_send_binary( dev, msg, sizeof(msg) );
+    }
+
+    /* $PSRF104: clock drift 0 keeps the last known value, 12 channels,
+     * reset 1 is a hot start like MID 128 above. 2 and 3 would clear the
+     * ephemeris.
+     */
+    return gps_dev_send( dev, "PSRF104,%.5f,%.5f,%d,0,%lld,%d,12,1",
+                         latitude, longitude, (int)altitude, tow / 1000, week );
+}
@@ -0,0 +1,119 @@
+#ifndef _gps_dev_h
+#define _gps_dev_h
+
+#include <termios.h>
+#include <hardware_legacy/gps.h>
+
+/* control of the SiRF receiver behind the serial port, through its NMEA
+ * input messages: $PSRF100 sets the port's baud rate and protocol, $PSRF103
+ * the output rate of each sentence. in binary mode the same settings are
+ * made with SiRF binary messages, see sirf_binary.h.
+ */
+
+/* what the receiver outputs */
+enum {
+    GPS_DEV_NMEA = (1 << 0),
+    GPS_DEV_SIRF = (1 << 1),    /* SiRF binary */
+};
+
+/* output period, in seconds, while no session is running and the fastest
+ * one used during a session
+ */
+#define GPS_DEV_SLOW_UPDATE_RATE (10)
+#define GPS_DEV_HIGH_UPDATE_RATE (1)
+
+/* the receiver's power-on default, and the rate it is switched to. at 4800
+ * bps a full 1 Hz burst takes most of the second to come through.
+ */
+#define GPS_DEV_DEFAULT_BAUD (B4800)
+#define GPS_DEV_LOW_BAUD  (B9600)
+#define GPS_DEV_HIGH_BAUD (B19200)
+
+/* sentences, as bits of their $PSRF103 message ids */
+enum {
+    GPS_DEV_GGA = (1 << 0),
+    GPS_DEV_GLL = (1 << 1),
+    GPS_DEV_GSA = (1 << 2),
+    GPS_DEV_GSV = (1 << 3),
+    GPS_DEV_RMC = (1 << 4),
+    GPS_DEV_VTG = (1 << 5),
+    GPS_DEV_ZDA = (1 << 8),
+};
+
+/* what the receiver sends after power-on */
+#define GPS_DEV_DEFAULT_SENTENCES \
+    (GPS_DEV_GGA|GPS_DEV_GLL|GPS_DEV_GSA|GPS_DEV_GSV|GPS_DEV_RMC|GPS_DEV_VTG)
+
+/* how long to listen for a valid sentence at each baud rate */
+#define GPS_DEV_PROBE_MS  1500
+
+typedef struct {
+    int      fd;
+    speed_t  baud;          /* current rate of the port and the receiver */
+    int      rate;          /* current output period, in seconds, 0 if unknown */
+    unsigned sentences;     /* GPS_DEV_XXX bits being output */
+    int      protocol;      /* GPS_DEV_NMEA or GPS_DEV_SIRF */
+} GpsDev;
+
+/* find the receiver's baud rate and switch it, and the tty, to
+ * GPS_DEV_HIGH_BAUD, or GPS_DEV_LOW_BAUD if that fails. 'bps' is the rate
+ * it was last left at, tried first, or 0 if unknown. blocks for up to a
+ * few seconds when that rate answers, up to 2 * 5 * GPS_DEV_PROBE_MS when
+ * nothing does. returns -1 if the receiver never answered, in which case
+ * the port is left at GPS_DEV_DEFAULT_BAUD.
+ */
+extern int
+gps_dev_init( GpsDev*  dev, int  fd, int  bps );
+
+/* the current rate of the port and the receiver, in bits per second */
+extern int
+gps_dev_bps( const GpsDev*  dev );
+
+/* put the receiver back to its defaults, NMEA at GPS_DEV_DEFAULT_BAUD, so
+ * that the next probe is quick
+ */
+extern void
+gps_dev_deinit( GpsDev*  dev );
+
+/* after the receiver was powered off and on again without
+ * gps_dev_deinit(), check that it still talks at the rate and protocol in
+ * 'dev', which are kept. returns -1 if it doesn't, gps_dev_init() then has
+ * to probe for it.
+ */
+extern int
+gps_dev_resume( GpsDev*  dev );
+
+/* match the output rate to a fix interval in ms, 0 for single-shot */
+extern void
+gps_dev_start( GpsDev*  dev, int  fix_interval );
+
+/* slow the output down while nobody is listening */
+extern void
+gps_dev_stop( GpsDev*  dev );
+
+/* only output the sentences in 'sentences', a mask of GPS_DEV_XXX. only
+ * the messages that change are sent to the receiver. in binary mode GSV
+ * stands for the tracker data and the other bits for the fix.
+ */
+extern void
+gps_dev_set_sentences( GpsDev*  dev, unsigned  sentences );
+
+/* GPS time is ahead of UTC by the leap seconds since 1980-01-06 */
+#define GPS_DEV_LEAP_SECONDS  18
+
+/* hot start the receiver from an approximate position, in degrees and
+ * meters above the ellipsoid, and the current UTC time in ms. ephemeris
+ * and almanac are kept on both protocols, but the navigation restarts, so
+ * only do it when there is no fix.
+ */
+extern int
+gps_dev_inject( GpsDev*  dev, double  latitude, double  longitude, double  altitude,
+                GpsUtcTime  utc );
+
+/* switch the receiver to GPS_DEV_NMEA or GPS_DEV_SIRF. returns -1 if it
+ * didn't switch, e.g. because the chipset has no binary mode.
+ */
+extern int
+gps_dev_set_protocol( GpsDev*  dev, int  protocol );
+
+#endif /* _gps_dev_h */
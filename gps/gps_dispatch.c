@@ -0,0 +1,337 @@
+#include <errno.h>
+#include <string.h>
+
+#define  LOG_TAG  "gps_dispatch"
+#include <cutils/log.h>
+
+#include "gps_dispatch.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+#define  RING_MASK  (GPS_DISPATCH_RING_SIZE-1)
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       D I S P A T C H E R   T H R E A D               *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* a fix or SV report is superseded when a newer one of the same type is
+ * queued before the next status event, status events are never reordered.
+ */
+static int
+gps_dispatch_superseded( GpsDispatch*  d, unsigned  pos, unsigned  head )
+{
+    int  type = d->ring[pos & RING_MASK].type;
+
+    /* NMEA batches don't matter here, they are delivered anyway */
+    for (pos++; pos != head; pos++) {
+        int  t = d->ring[pos & RING_MASK].type;
+        if (t == type)
+            return 1;
+        if (t == GPS_EVENT_STATUS)
+            return 0;
+    }
+    return 0;
+}
+
+
+/* nmea_cb takes one sentence at a time, with the batch's timestamp */
+typedef struct {
+    gps_nmea_callback  func;
+    GpsUtcTime         timestamp;
+} GpsNmeaTarget;
+
+static void
+gps_dispatch_nmea_sentence( void*  opaque, const char*  p, const char*  end )
+{
+    GpsNmeaTarget*  t = opaque;
+
+    t->func( t->timestamp, p, end - p );
+}
+
+
+static void
+gps_dispatch_run( GpsDispatch*  d, GpsEvent*  ev )
+{
+    const GpsCallbacks*  cb = d->callbacks;
+    GpsMetrics*          m  = d->metrics;
+    unsigned             delivered = d->stats.delivered;
+    uint64_t             start = m ? gps_metrics_now() : 0;
+
+    switch (ev->type) {
+    case GPS_EVENT_FIX:
+        if (cb->location_cb) {
+            cb->location_cb( &ev->u.fix );
+            d->stats.delivered += 1;
+        }
+        break;
+    case GPS_EVENT_SV:
+        if (cb->sv_status_cb) {
+            cb->sv_status_cb( &ev->u.sv );
+            d->stats.delivered += 1;
+        }
+        break;
+    case GPS_EVENT_SV_EXT:
+        if (d->sv_ext_callbacks && d->sv_ext_callbacks->sv_ext_status_cb) {
+            d->sv_ext_callbacks->sv_ext_status_cb( &ev->u.sv_ext );
+            d->stats.delivered += 1;
+        }
+        break;
+    case GPS_EVENT_SV_DELTA:
+        if (d->sv_delta_callbacks && d->sv_delta_callbacks->sv_delta_cb) {
+            d->sv_delta_callbacks->sv_delta_cb( &ev->u.sv_delta );
+            d->stats.delivered += 1;
+        }
+        break;
+    case GPS_EVENT_STATUS:
+        if (cb->status_cb) {
+            GpsStatus  status;
+            status.status = ev->u.status;
+            cb->status_cb( &status );
+            d->stats.delivered += 1;
+        }
+        break;
+    case GPS_EVENT_NMEA:
+        if (cb->nmea_cb) {
+            GpsNmeaTarget  t = { cb->nmea_cb, ev->u.nmea.timestamp };
+            nmea_batch_foreach( &ev->u.nmea, gps_dispatch_nmea_sentence, &t );
+            d->stats.delivered += 1;
+        }
+        break;
+    }
+
+    if (m && d->stats.delivered != delivered) {
+        uint64_t  end = gps_metrics_now();
+
+        gps_histogram_add( &m->callback, end - start );
+        if (ev->type == GPS_EVENT_FIX && ev->rx_time != 0)
+            gps_histogram_add( &m->fix_latency, end - ev->rx_time );
+    }
+}
+
+
+static void
+gps_dispatch_drain( GpsDispatch*  d )
+{
+    unsigned  tail = d->tail;
+    unsigned  head = d->head;
+
+    /* don't read the events before the head that published them */
+    __sync_synchronize();
+
+    while (tail != head) {
+        GpsEvent*  ev = &d->ring[tail & RING_MASK];
+
+        if ((ev->type == GPS_EVENT_FIX || ev->type == GPS_EVENT_SV ||
+             ev->type == GPS_EVENT_SV_EXT) &&
+            gps_dispatch_superseded(d, tail, head)) {
+            D("event %d superseded", ev->type);
+            d->stats.coalesced += 1;
+        } else
+            gps_dispatch_run( d, ev );
+
+        tail += 1;
+        /* the slot must be consumed before the producer can reuse it */
+        __sync_synchronize();
+        d->tail = tail;
+    }
+}
+
+
+static void*
+gps_dispatch_thread( void*  arg )
+{
+    GpsDispatch*  d = arg;
+
+    D("dispatcher running");
+    for (;;) {
+        int  ret;
+        do {
+            ret = sem_wait( &d->wakeup );
+        } while (ret < 0 && errno == EINTR);
+
+        gps_dispatch_drain( d );
+        if (d->quit) {
+            /* pick up what was queued while we were draining */
+            __sync_synchronize();
+            gps_dispatch_drain( d );
+            break;
+        }
+    }
+    D("dispatcher done");
+    return NULL;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       P R O D U C E R                                 *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+int
+gps_dispatch_init( GpsDispatch*  d, const GpsCallbacks*  callbacks )
+{
+    memset( d, 0, sizeof(*d) );
+    d->callbacks = callbacks;
+
+    if (sem_init( &d->wakeup, 0, 0 ) != 0) {
+        LOGE("could not create dispatcher semaphore: %s", strerror(errno));
+        return -1;
+    }
+    if (pthread_create( &d->thread, NULL, gps_dispatch_thread, d ) != 0) {
+        LOGE("could not create dispatcher thread: %s", strerror(errno));
+        sem_destroy( &d->wakeup );
+        d->callbacks = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+void
+gps_dispatch_done( GpsDispatch*  d )
+{
+    void*  dummy;
+
+    d->quit = 1;
+    sem_post( &d->wakeup );
+    pthread_join( d->thread, &dummy );
+    sem_destroy( &d->wakeup );
+
+    LOGD("dispatcher: %u events, %u delivered, %u coalesced, %u dropped (%u nmea sentences)",
+         d->stats.posted, d->stats.delivered, d->stats.coalesced, d->stats.dropped,
+         d->stats.nmea_dropped);
+}
+
+
+/* returns the next free slot, or NULL if the ring is too full for this
+ * type of event
+ */
+static GpsEvent*
+gps_dispatch_reserve( GpsDispatch*  d, int  type )
+{
+    unsigned  used    = d->head - d->tail;
+    unsigned  reserve = 0;
+
+    if (type != GPS_EVENT_STATUS)
+        reserve += GPS_DISPATCH_STATUS_SLOTS;
+    if (type == GPS_EVENT_NMEA)
+        reserve += GPS_DISPATCH_FIX_SLOTS;
+
+    if (used + reserve >= GPS_DISPATCH_RING_SIZE) {
+        D("ring full, event %d dropped", type);
+        d->stats.dropped += 1;
+        return NULL;
+    }
+    /* the dispatcher must be done with the slot before we overwrite it */
+    __sync_synchronize();
+    return &d->ring[d->head & RING_MASK];
+}
+
+
+static void
+gps_dispatch_commit( GpsDispatch*  d, GpsEvent*  ev, int  type )
+{
+    ev->type = type;
+    __sync_synchronize();
+    d->head += 1;
+    d->stats.posted += 1;
+    sem_post( &d->wakeup );
+}
+
+
+void
+gps_dispatch_fix( GpsDispatch*  d, const GpsLocation*  fix, uint64_t  rx_time )
+{
+    GpsEvent*  ev = gps_dispatch_reserve( d, GPS_EVENT_FIX );
+
+    if (ev != NULL) {
+        ev->rx_time = rx_time;
+        ev->u.fix   = *fix;
+        gps_dispatch_commit( d, ev, GPS_EVENT_FIX );
+    }
+}
+
+
+void
+gps_dispatch_sv( GpsDispatch*  d, const GpsSvStatus*  sv )
+{
+    GpsEvent*  ev = gps_dispatch_reserve( d, GPS_EVENT_SV );
+
+    if (ev != NULL) {
+        ev->u.sv = *sv;
+        gps_dispatch_commit( d, ev, GPS_EVENT_SV );
+    }
+}
+
+
+void
+gps_dispatch_sv_ext( GpsDispatch*  d, const GpsSvExtStatus*  sv )
+{
+    GpsEvent*  ev = gps_dispatch_reserve( d, GPS_EVENT_SV_EXT );
+
+    if (ev != NULL) {
+        ev->u.sv_ext = *sv;
+        gps_dispatch_commit( d, ev, GPS_EVENT_SV_EXT );
+    }
+}
+
+
+int
+gps_dispatch_sv_delta( GpsDispatch*  d, const GpsSvDelta*  delta )
+{
+    GpsEvent*  ev = gps_dispatch_reserve( d, GPS_EVENT_SV_DELTA );
+
+    if (ev == NULL)
+        return -1;
+
+    /* only the used part of the table is copied */
+    ev->u.sv_delta.reset        = delta->reset;
+    ev->u.sv_delta.num_svs      = delta->num_svs;
+    ev->u.sv_delta.num_used_svs = delta->num_used_svs;
+    ev->u.sv_delta.num_changes  = delta->num_changes;
+    memcpy( ev->u.sv_delta.changes, delta->changes,
+            delta->num_changes * sizeof(delta->changes[0]) );
+    gps_dispatch_commit( d, ev, GPS_EVENT_SV_DELTA );
+    return 0;
+}
+
+
+void
+gps_dispatch_status( GpsDispatch*  d, GpsStatusValue  status )
+{
+    GpsEvent*  ev = gps_dispatch_reserve( d, GPS_EVENT_STATUS );
+
+    if (ev != NULL) {
+        ev->u.status = status;
+        gps_dispatch_commit( d, ev, GPS_EVENT_STATUS );
+    }
+}
+
+
+void
+gps_dispatch_nmea( GpsDispatch*  d, const NmeaBatch*  batch )
+{
+    GpsEvent*  ev = gps_dispatch_reserve( d, GPS_EVENT_NMEA );
+
+    if (ev == NULL) {
+        d->stats.nmea_dropped += batch->count;
+        return;
+    }
+    ev->u.nmea.timestamp = batch->timestamp;
+    ev->u.nmea.len       = batch->len;
+    ev->u.nmea.count     = batch->count;
+    memcpy( ev->u.nmea.buf, batch->buf, batch->len );
+    gps_dispatch_commit( d, ev, GPS_EVENT_NMEA );
+}
@@ -0,0 +1,111 @@
+#ifndef _gps_dispatch_h
+#define _gps_dispatch_h
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <hardware_legacy/gps.h>
+#include <hardware_legacy/gps_sv_ext.h>
+
+#include "gps_metrics.h"
+#include "nmea_framer.h"
+
+/* events queued for the dispatcher thread */
+enum {
+    GPS_EVENT_FIX    = 0,
+    GPS_EVENT_SV     = 1,
+    GPS_EVENT_STATUS = 2,
+    GPS_EVENT_NMEA   = 3,
+    GPS_EVENT_SV_EXT = 4,
+    GPS_EVENT_SV_DELTA = 5,     /* never coalesced, each one builds on the last */
+};
+
+typedef struct {
+    int       type;
+    uint64_t  rx_time;      /* of the epoch's first read(), in us, or 0 */
+    union {
+        GpsLocation     fix;
+        GpsSvStatus     sv;
+        GpsSvExtStatus  sv_ext;
+        GpsSvDelta      sv_delta;
+        GpsStatusValue  status;
+        NmeaBatch       nmea;
+    } u;
+} GpsEvent;
+
+/* must be a power of 2 */
+#define  GPS_DISPATCH_RING_SIZE  32
+
+/* slots kept free for status events, which are never dropped to make
+ * room for fixes
+ */
+#define  GPS_DISPATCH_STATUS_SLOTS  4
+
+/* raw NMEA is dropped first when the framework is slow, these slots are
+ * kept for fixes and SV reports
+ */
+#define  GPS_DISPATCH_FIX_SLOTS  8
+
+typedef struct {
+    unsigned  posted;           /* events queued by the producer */
+    unsigned  delivered;        /* callbacks actually run */
+    unsigned  coalesced;        /* fixes or SV reports superseded in the ring */
+    unsigned  dropped;          /* events lost because the ring was full */
+    unsigned  nmea_dropped;     /* sentences in the NMEA batches among them */
+} GpsDispatchStats;
+
+/* a single producer (the GPS thread) queues events, a dispatcher thread
+ * runs the framework callbacks, so that a slow callback never holds up
+ * reading and parsing the receiver's output. when the framework falls
+ * behind, a fix or SV report that has a newer one behind it in the ring
+ * is skipped.
+ */
+typedef struct {
+    const GpsCallbacks*  callbacks;
+    volatile unsigned    head;      /* written by the producer only */
+    volatile unsigned    tail;      /* written by the dispatcher only */
+    volatile int         quit;
+    sem_t                wakeup;
+    pthread_t            thread;
+    GpsDispatchStats     stats;
+    GpsMetrics*          metrics;   /* optional, set after gps_dispatch_init() */
+    const GpsSvExtCallbacks*  sv_ext_callbacks;  /* optional, read at dispatch time */
+    const GpsSvDeltaCallbacks*  sv_delta_callbacks;
+    GpsEvent             ring[ GPS_DISPATCH_RING_SIZE ];
+} GpsDispatch;
+
+/* 'callbacks' is read at dispatch time, so it can be filled in later.
+ * returns -1 on failure, in which case d->callbacks is NULL.
+ */
+extern int
+gps_dispatch_init( GpsDispatch*  d, const GpsCallbacks*  callbacks );
+
+/* runs the events still queued, then stops the dispatcher thread */
+extern void
+gps_dispatch_done( GpsDispatch*  d );
+
+/* producer side, these never block. 'rx_time' is the gps_metrics_now()
+ * time at which the fix's epoch started arriving, 0 if unknown.
+ */
+extern void
+gps_dispatch_fix( GpsDispatch*  d, const GpsLocation*  fix, uint64_t  rx_time );
+
+extern void
+gps_dispatch_sv( GpsDispatch*  d, const GpsSvStatus*  sv );
+
+extern void
+gps_dispatch_sv_ext( GpsDispatch*  d, const GpsSvExtStatus*  sv );
+
+/* returns -1 if the delta was dropped, the next one must then be a reset */
+extern int
+gps_dispatch_sv_delta( GpsDispatch*  d, const GpsSvDelta*  delta );
+
+extern void
+gps_dispatch_status( GpsDispatch*  d, GpsStatusValue  status );
+
+/* NMEA batches are never coalesced, the consumer wants every sentence.
+ * nmea_cb is called once per sentence of the batch.
+ */
+extern void
+gps_dispatch_nmea( GpsDispatch*  d, const NmeaBatch*  batch );
+
+#endif /* _gps_dispatch_h */
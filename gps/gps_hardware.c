@@ -7,7 +7,7 @@
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
-#include <semaphore.h>
+#include <sys/timerfd.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -17,6 +17,18 @@
 #include <cutils/sockets.h>
 #include <cutils/properties.h>
 #include <hardware_legacy/gps.h>
+#include <hardware_legacy/gps_debug.h>
+#include <hardware_legacy/gps_sv_ext.h>
+
+#include "gps_cache.h"
+#include "gps_dev.h"
+#include "gps_dispatch.h"
+#include "gps_logger.h"
+#include "gps_metrics.h"
+#include "gps_sv_delta.h"
+#include "nmea_framer.h"
+#include "nmea_parser.h"
+#include "sirf_binary.h"
 
 #define  GPS_DEBUG  0
 
@@ -28,736 +40,602 @@
 #define  D(...)   ((void)0)
 #endif
 
-#define GPS_STATUS_CB(_cb, _s)    \
-    if ((_cb).status_cb) {          \
-    GpsStatus gps_status;         \
-    gps_status.status = (_s);     \
-    (_cb).status_cb(&gps_status); \
-    DFR("gps status callback: 0x%x", _s); \
+#define GPS_STATUS_CB(_s, _status)    \
+    {                                  \
+    gps_dispatch_status(&(_s)->dispatch, (_status)); \
+    DFR("gps status callback: 0x%x", _status); \
     }
 
-/* Nmea Parser stuff */
-#define  NMEA_MAX_SIZE  83
-
 enum {
     STATE_QUIT  = 0,
     STATE_INIT  = 1,
     STATE_START = 2
 };
 
+/* the last published epoch. only the gps thread uses it, the dispatcher
+ * gets copies. the sequence numbers count publications, a reader compares
+ * them with the last one it handled.
+ */
 typedef struct {
-    int     pos;
-    int     overflow;
-    int     utc_year;
-    int     utc_mon;
-    int     utc_day;
-    int     utc_diff;
-    GpsLocation  fix;
-    GpsSvStatus  sv_status;
-    int     sv_status_changed;
-    char    in[ NMEA_MAX_SIZE+1 ];
-} NmeaReader;
-
-/* Since NMEA parser requires lcoks */
-#define GPS_STATE_LOCK_FIX(_s)         \
-{                                      \
-    int ret;                             \
-    do {                                 \
-        ret = sem_wait(&(_s)->fix_sem);    \
-    } while (ret < 0 && errno == EINTR);   \
-}
+    unsigned                fix_seq;
+    GpsLocation             fix;
+    unsigned                sv_seq;
+    GpsSvStatus             sv;
+    GpsSvExtStatus          sv_ext;         /* published with sv */
+} GpsSnapshot;
+
+/* how the serial port is read, from the "gps.read.mode" property */
+enum {
+    GPS_READ_LEGACY = 0,    /* "legacy": VMIN=1, one read() per wakeup */
+    GPS_READ_DRAIN  = 1,    /* "drain": VMIN=1, edge-triggered, read until EAGAIN */
+    GPS_READ_BATCH  = 2     /* "batch": VMIN=GPS_READ_VMIN, drain, idle flush */
+};
 
-#define GPS_STATE_UNLOCK_FIX(_s)       \
-    sem_post(&(_s)->fix_sem)
+/* in batch mode the tty only wakes us once this many bytes are waiting,
+ * less than a typical sentence.
+ */
+#define GPS_READ_VMIN     64
+
+/* the tail of a burst that is too short for VMIN is read this long after
+ * the last read, about ten characters at 4800 bps and more at the rate
+ * gps_dev_init() switches to. reads are repeated at this interval until
+ * one finds nothing, so a tail still arriving isn't left for the next
+ * burst.
+ */
+#define GPS_READ_IDLE_MS  25
+
+typedef struct {
+    unsigned  wakeups;      /* thread wakeups for the serial port */
+    unsigned  reads;        /* read() calls, including the final EAGAIN */
+    unsigned  bytes;
+    unsigned  idle_reads;   /* wakeups from the idle timeout */
+} GpsReadStats;
+
+/* aiding data from the framework, forwarded to the receiver by the gps
+ * thread. the time is ignored past GPS_AID_MAX_TIME_UNCERTAINTY ms of
+ * uncertainty, the position past GPS_AID_MAX_ACCURACY meters.
+ */
+#define GPS_AID_MAX_TIME_UNCERTAINTY  2000
+#define GPS_AID_MAX_ACCURACY          30000
+
+typedef struct {
+    int                     time_valid;
+    GpsUtcTime              time;           /* UTC at time_ref */
+    int64_t                 time_ref;       /* CLOCK_MONOTONIC, in ms */
+    int                     location_valid;
+    double                  latitude;
+    double                  longitude;
+    double                  altitude;       /* 0 if unknown */
+} GpsAiding;
+
+/* duty cycling: with a fix interval of at least GPS_DUTY_MIN_INTERVAL ms
+ * the receiver is powered off after each fix, and powered on again ahead
+ * of the next one by the time it took to reacquire, plus a margin. it is
+ * left on when it would be off for less than GPS_DUTY_MIN_SLEEP_MS, and
+ * for the rest of the session once reacquiring takes too long for that.
+ */
+#define GPS_DUTY_MIN_INTERVAL   30000
+#define GPS_DUTY_MIN_SLEEP_MS   10000
+#define GPS_DUTY_MARGIN_MS      2000
+
+/* reacquisition estimate before anything was measured, a warm start */
+#define GPS_DUTY_INITIAL_REACQ  10000
+
+typedef struct {
+    int                     off;            /* the receiver is powered off */
+    int                     fallback;       /* continuous for this session */
+    int64_t                 wake_time;      /* CLOCK_MONOTONIC ms of power-on, 0 once reacquired */
+    int                     reacq;          /* estimated reacquisition time, in ms */
+    int                     reacquired;     /* a position was parsed since power-on */
+    int                     fix_delivered;  /* a fix with a position went out */
+    unsigned                sleeps;         /* power-offs in this session */
+} GpsDuty;
 
 typedef struct {
     int                     init;
     int                     fd;
+    GpsDev                  dev;            /* receiver baud and output rate */
+    int                     protocol;       /* wanted, GPS_DEV_NMEA or GPS_DEV_SIRF */
+    int                     read_mode;      /* GPS_READ_XXX */
+    GpsReadStats            read_stats;     /* for the current session */
     GpsCallbacks            callbacks;
+    GpsSvExtCallbacks       sv_ext_callbacks;   /* see gps_sv_ext.h */
+    GpsSvDeltaCallbacks     sv_delta_callbacks;
+    GpsSvDeltaState         sv_delta;       /* what the SV callbacks last got */
+    unsigned                sv_reports;     /* SV reports due in this session */
+    unsigned                sv_unchanged;   /* of which nothing was delivered */
+    GpsDuty                 duty;
     pthread_t               thread;
-    pthread_t               tmr_thread;
     int                     control[2];
-    int                     fix_freq;
-    sem_t                   fix_sem;
+    int                     fix_interval;   /* in ms, 0 for single-shot, -1 for none */
     int                     first_fix;
     NmeaReader              reader;
+    SirfReader              sirf;           /* used when the receiver is in binary mode */
+    GpsSnapshot             snapshot;
+    GpsDispatch             dispatch;       /* runs the framework callbacks */
+    GpsLogger               logger;         /* field logs, see "sys.gps.log" */
+    unsigned                fix_seen;       /* last fix_seq handled */
+    unsigned                sv_seen;        /* last sv_seq handled */
+    int                     fix_due;        /* deliver the next fix epoch */
+    int                     sv_due;         /* deliver the next GSV cycle */
+    NmeaBatch               nmea;           /* raw sentences of the current epoch */
+    int                     nmea_split;     /* epoch boundary seen by the parser */
+    int64_t                 rx_time;        /* reception time of the current chunk */
+    pthread_mutex_t         aiding_lock;
+    GpsAiding               aiding;
+    int                     aiding_injected; /* warm started in this session or power-on */
+    int                     position_seen;  /* a position came since power-on */
+    GpsCache                cache;          /* last fix of earlier sessions */
+    GpsCacheEntry           cache_entry;    /* what the next save writes */
+    int                     cache_dirty;    /* a fix came since the last save */
+    uint64_t                rx_mono;        /* gps_metrics_now() of the current chunk */
+    uint64_t                epoch_rx;       /* of the current epoch's first sentence, 0 if none yet */
+    uint64_t                fix_rx;         /* epoch_rx of the last published fix */
+    uint64_t                parse_time;     /* spent on the current epoch, in us */
+    int                     epoch_done;     /* an epoch ended in the current chunk */
+    uint64_t                session_start;  /* until the session's first fix, else 0 */
 
 } GpsState;
 
 static GpsState  _gps_state[1];
 static GpsState *gps_state = _gps_state;
 
+/* kept across cleanup, see gps_debug.h */
+static GpsMetrics  gps_metrics;
+
 //#define GPS_POWER_IF "/sys/bus/platform/devices/neo1973-pm-gps.0/power_on"
 
-#define GPS_DEV_SLOW_UPDATE_RATE (10)
-#define GPS_DEV_HIGH_UPDATE_RATE (1)
 
-#define GPS_DEV_LOW_BAUD  (B9600)
-#define GPS_DEV_HIGH_BAUD (B19200)
+static void gps_snapshot_put_fix( GpsSnapshot*  snap, const GpsLocation*  fix )
+{
+    snap->fix      = *fix;
+    snap->fix_seq += 1;
+}
 
-static void gps_dev_init(int fd);
-static void gps_dev_deinit(int fd);
-static void gps_dev_start(int fd);
-static void gps_dev_stop(int fd);
-static void *gps_timer_thread( void*  arg );
+static void gps_snapshot_put_sv( GpsSnapshot*  snap, const GpsSvStatus*  sv,
+                                 const GpsSvExtStatus*  sv_ext )
+{
+    snap->sv      = *sv;
+    snap->sv_ext  = *sv_ext;
+    snap->sv_seq += 1;
+}
 
-/*****************************************************************/
-/*****************************************************************/
-/*****                                                       *****/
-/*****       N M E A   T O K E N I Z E R    *****/
-/*****                                                       *****/
-/*****************************************************************/
-/*****************************************************************/
+/* called by the parser for each complete epoch. this only publishes the
+ * epoch, gps_state_deliver() queues it for the dispatcher once the whole
+ * chunk read from the receiver has been parsed.
+ */
+static void nmea_reader_epoch( void*  opaque, NmeaReader*  r, int  what )
+{
+    GpsState*  state = opaque;
 
-typedef struct {
-    const char*  p;
-    const char*  end;
-} Token;
+    if (what & NMEA_EPOCH_FIX)
+    {
+        gps_snapshot_put_fix(&state->snapshot, &r->fix);
+        state->fix_rx = state->epoch_rx;
+    }
+    if (what & NMEA_EPOCH_SV)
+        gps_snapshot_put_sv(&state->snapshot, &r->sv_status, &r->sv_ext);
+    state->nmea_split |= what & (NMEA_EPOCH_END | NMEA_EPOCH_NEXT);
+    if (what & (NMEA_EPOCH_END | NMEA_EPOCH_NEXT))
+        state->epoch_done = 1;
+}
 
-#define  MAX_NMEA_TOKENS  32
+/* the SiRF receiver only tracks GPS, whose slots in the extended bitsets
+ * are laid out as the legacy masks
+ */
+static void gps_sv_ext_from_status( GpsSvExtStatus*  ext, const GpsSvStatus*  sv )
+{
+    int  i;
+
+    memset( ext, 0, sizeof(*ext) );
+    ext->num_used_svs        = sv->num_used_svs;
+    ext->used_in_fix_mask[0] = sv->used_in_fix_mask;
+    ext->ephemeris_mask[0]   = sv->ephemeris_mask;
+    ext->almanac_mask[0]     = sv->almanac_mask;
+    for (i = 0; i < sv->num_svs; i++)
+    {
+        const GpsSvInfo*  info = &sv->sv_list[i];
+        GpsSvExtInfo*     out  = &ext->sv_list[ext->num_svs];
+        int               slot = gps_sv_ext_slot( GPS_CONSTELLATION_GPS, info->prn );
 
-typedef struct {
-    int     count;
-    Token   tokens[ MAX_NMEA_TOKENS ];
-} NmeaTokenizer;
+        if (slot < 0)
+            continue;
+        out->constellation = GPS_CONSTELLATION_GPS;
+        out->svid          = info->prn;
+        out->snr           = info->snr;
+        out->elevation     = info->elevation;
+        out->azimuth       = info->azimuth;
+        out->flags         = 0;
+        if (gps_sv_ext_test( ext->used_in_fix_mask, slot ))
+            out->flags |= GPS_SV_EXT_USED_IN_FIX;
+        if (gps_sv_ext_test( ext->ephemeris_mask, slot ))
+            out->flags |= GPS_SV_EXT_HAS_EPHEMERIS;
+        if (gps_sv_ext_test( ext->almanac_mask, slot ))
+            out->flags |= GPS_SV_EXT_HAS_ALMANAC;
+        ext->num_svs += 1;
+    }
+}
 
-static int nmea_tokenizer_init( NmeaTokenizer*  t, const char*  p, const char*  end )
+/* the binary equivalent of nmea_reader_epoch(), each message is a
+ * complete epoch so there are no sentences to batch
+ */
+static void sirf_reader_epoch( void*  opaque, SirfReader*  r, int  what )
 {
-    int    count = 0;
-    char*  q;
-// the initial '$' is optional
-    if (p < end && p[0] == '$')
-        p += 1;
-// remove trailing newline
-    if (end > p && end[-1] == '\n') 
+    GpsState*  state = opaque;
+
+    if (what & SIRF_EPOCH_FIX)
     {
-        end -= 1;
-        if (end > p && end[-1] == '\r')
-            end -= 1;
+        gps_snapshot_put_fix(&state->snapshot, &r->fix);
+        state->fix_rx     = state->rx_mono;
+        state->epoch_done = 1;
     }
-// get rid of checksum at the end of the sentecne
-    if (end >= p+3 && end[-3] == '*') 
+    if (what & SIRF_EPOCH_SV)
     {
-        end -= 3;
+        GpsSnapshot*  snap = &state->snapshot;
+
+        snap->sv = r->sv_status;
+        gps_sv_ext_from_status( &snap->sv_ext, &r->sv_status );
+        snap->sv_seq += 1;
     }
-    while (p < end) 
+}
+
+/* raw sentences are queued for the dispatcher one epoch at a time rather
+ * than one ring slot per sentence, it still calls nmea_cb for each. a
+ * batch that would overflow is sent early.
+ */
+static void gps_state_flush_nmea( GpsState*  state )
+{
+    if (state->nmea.count > 0)
     {
-        const char*  q = p;
-        q = memchr(p, ',', end-p);
-        if (q == NULL)
-            q = end;
-        if (count < MAX_NMEA_TOKENS) 
-        {
-            t->tokens[count].p   = p;
-            t->tokens[count].end = q;
-            count += 1;
-        }
-        if (q < end)
-           q += 1;
-        p = q;
+        gps_dispatch_nmea( &state->dispatch, &state->nmea );
+        nmea_batch_reset( &state->nmea );
     }
-    t->count = count;
-    return count;
 }
 
-static Token nmea_tokenizer_get( NmeaTokenizer*  t, int  index )
+static void gps_state_add_nmea( GpsState*  state, const char*  s, const char*  end )
 {
-    Token  tok;
-    static const char*  dummy = "";
-    if (index < 0 || index >= t->count)
+    if (state->init != STATE_START || !state->callbacks.nmea_cb)
+        return;
+
+    if (nmea_batch_add( &state->nmea, s, end, state->rx_time ) < 0)
     {
-        tok.p = tok.end = dummy;
-    } else
-        tok = t->tokens[index];
-    return tok;
+        gps_state_flush_nmea( state );
+        nmea_batch_add( &state->nmea, s, end, state->rx_time );
+    }
 }
 
-
-static int str2int( const char*  p, const char*  end )
+/* the fix timer only marks when a delivery is due, the epoch published
+ * after that is delivered as soon as it is complete, so fixes are never
+ * older than one receiver epoch.
+ */
+static void gps_state_deliver( GpsState*  state )
 {
-    int   result = 0;
-    int   len    = end - p;
+    GpsSnapshot*  snap = &state->snapshot;
 
-    if (len == 0) 
+    if (snap->fix_seq != state->fix_seen)
     {
-        return -1;
+        const GpsLocation*  fix = &snap->fix;
+
+        state->fix_seen = snap->fix_seq;
+        if (fix->flags & GPS_LOCATION_HAS_LAT_LONG)
+        {
+            gps_cache_set_fix( &state->cache_entry, fix, state->rx_time );
+            state->cache_dirty = 1;
+            state->position_seen = 1;
+            /* whether or not a delivery is due */
+            if (state->duty.wake_time)
+                state->duty.reacquired = 1;
+            if (state->session_start)
+            {
+                gps_histogram_add( &gps_metrics.ttff, gps_metrics_now() - state->session_start );
+                state->session_start = 0;
+            }
+        }
+        if (state->init == STATE_START)
+        {
+            if (state->fix_due)
+            {
+                D("gps fix cb: 0x%x", fix->flags);
+                gps_dispatch_fix( &state->dispatch, fix, state->fix_rx );
+                state->first_fix = 1;
+                state->fix_due = 0;
+                if (fix->flags & GPS_LOCATION_HAS_LAT_LONG)
+                    state->duty.fix_delivered = 1;
+                if (state->fix_interval == 0)
+                {
+                    state->fix_interval = -1;
+                }
+            }
+        } else if (!state->first_fix &&
+                   state->init == STATE_INIT &&
+                   fix->flags & GPS_LOCATION_HAS_LAT_LONG)
+        {
+            gps_dispatch_fix( &state->dispatch, fix, state->fix_rx );
+            state->first_fix = 1;
+        }
     }
-    for ( ; len > 0; len--, p++ )
+
+    if (snap->sv_seq != state->sv_seen)
     {
-        int  c;
-        if (p >= end)
-            goto Fail;
-        c = *p - '0';
-        if ((unsigned)c >= 10)
-            goto Fail;
-        result = result*10 + c;
-    }
-    return  result;
+        GpsSvDelta  delta;
 
-Fail:
-    return -1;
+        state->sv_seen = snap->sv_seq;
+        if (state->init == STATE_START && state->sv_due)
+        {
+            /* a GSV cycle comes every epoch, the callbacks only run when
+             * a satellite moved past the thresholds of gps_sv_delta.h
+             */
+            state->sv_due = 0;
+            state->sv_reports += 1;
+            if (gps_sv_delta_update( &state->sv_delta, &snap->sv_ext, &delta ) == 0)
+            {
+                state->sv_unchanged += 1;
+                return;
+            }
+            D("gps sv status callback, %d changes", delta.num_changes);
+            gps_dispatch_sv( &state->dispatch, &snap->sv );
+            if (state->sv_ext_callbacks.sv_ext_status_cb)
+                gps_dispatch_sv_ext( &state->dispatch, &snap->sv_ext );
+            if (state->sv_delta_callbacks.sv_delta_cb &&
+                gps_dispatch_sv_delta( &state->dispatch, &delta ) < 0)
+            {
+                gps_sv_delta_reset( &state->sv_delta );
+            }
+        }
+    }
 }
 
-static double str2float( const char*  p, const char*  end )
+/* called by the framer for each complete sentence. an epoch's arrival
+ * time is that of the read() that completed its first sentence.
+ */
+static void nmea_reader_sentence( void*  opaque, const char*  s, const char*  end )
 {
-    int   result = 0;
-    int   len    = end - p;
-    char  temp[16];
-
-    if (len == 0) 
-    {
-        return -1.0;
-    }
-    if (len >= (int)sizeof(temp))
-        return 0.;
-    memcpy( temp, p, len );
-    temp[len] = 0;
-    return strtod( temp, NULL );
+    NmeaReader*  r = opaque;
+
+    if (!gps_state->epoch_rx)
+        gps_state->epoch_rx = gps_state->rx_mono;
+    gps_state->nmea_split = 0;
+    nmea_reader_parse( r, s, end );
+    /* this sentence started the next epoch, or the next one will */
+    if (gps_state->nmea_split & NMEA_EPOCH_NEXT)
+        gps_state->epoch_rx = gps_state->rx_mono;
+    else if (gps_state->nmea_split & NMEA_EPOCH_END)
+        gps_state->epoch_rx = 0;
+
+    if (gps_state->nmea_split & NMEA_EPOCH_NEXT)
+        gps_state_flush_nmea( gps_state );
+    gps_state_add_nmea( gps_state, s, end );
+    if (gps_state->nmea_split & NMEA_EPOCH_END)
+        gps_state_flush_nmea( gps_state );
 }
 
 /*****************************************************************/
 /*****************************************************************/
 /*****                                                       *****/
-/*****       N M E A   P A R S E R           *****/
+/*****       C O N N E C T I O N   S T A T E *****/
 /*****                                                       *****/
 /*****************************************************************/
 /*****************************************************************/
 
-static void nmea_reader_update_utc_diff( NmeaReader*  r )
-{
-    time_t         now = time(NULL);
-    struct tm      tm_local;
-    struct tm      tm_utc;
-    long           time_local, time_utc;
-    gmtime_r( &now, &tm_utc );
-    localtime_r( &now, &tm_local );
-    time_local = tm_local.tm_sec +
-                 60*(tm_local.tm_min +
-                 60*(tm_local.tm_hour +
-                 24*(tm_local.tm_yday +
-                 365*tm_local.tm_year)));
-    time_utc = tm_utc.tm_sec +
-               60*(tm_utc.tm_min +
-               60*(tm_utc.tm_hour +
-               24*(tm_utc.tm_yday +
-               365*tm_utc.tm_year)));
-    r->utc_diff = time_utc - time_local;
-}
-
+/* commands sent to the gps thread */
+enum {
+    CMD_QUIT     = 0,
+    CMD_START    = 1,
+    CMD_STOP     = 2,
+    CMD_INTERVAL = 3,
+    CMD_CALLBACKS = 4,
+    CMD_AIDING   = 5
+};
 
-static void nmea_reader_init( NmeaReader*  r )
+static int64_t gps_monotonic_ms(void)
 {
-    memset( r, 0, sizeof(*r) );
-    r->pos      = 0;
-    r->overflow = 0;
-    r->utc_year = -1;
-    r->utc_mon  = -1;
-    r->utc_day  = -1;
-    nmea_reader_update_utc_diff( r );
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static int nmea_reader_update_time( NmeaReader*  r, Token  tok )
+/* tell the gps thread that new aiding data is there */
+static void gps_state_update_aiding(GpsState *s)
 {
-    int        hour, minute;
-    double     seconds;
-    struct tm  tm;
-    time_t     fix_time;
-    if (tok.p + 6 > tok.end)
-        return -1;
-    if (r->utc_year < 0) 
+    char  cmd = CMD_AIDING;
+    int   ret;
+    do {
+        ret=write( s->control[0], &cmd, 1 );
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1)
     {
-// no date yet, get current one
-        time_t  now = time(NULL);
-        gmtime_r( &now, &tm );
-        r->utc_year = tm.tm_year + 1900;
-        r->utc_mon  = tm.tm_mon + 1;
-        r->utc_day  = tm.tm_mday;
+        D("%s: could not send CMD_AIDING command: ret=%d: %s",
+           __FUNCTION__, ret, strerror(errno));
     }
-    hour    = str2int(tok.p,   tok.p+2);
-    minute  = str2int(tok.p+2, tok.p+4);
-    seconds = str2float(tok.p+4, tok.end);
-    tm.tm_hour = hour;
-    tm.tm_min  = minute;
-    tm.tm_sec  = (int) seconds;
-    tm.tm_year = r->utc_year - 1900;
-    tm.tm_mon  = r->utc_mon - 1;
-    tm.tm_mday = r->utc_day;
-    fix_time = mktime( &tm ) + r->utc_diff;
-    r->fix.timestamp = (long long)fix_time * 1000;
-    return 0;
 }
 
-static int nmea_reader_update_cdate( NmeaReader*  r, Token  tok_d, Token tok_m, Token tok_y )
-{
-    if ( (tok_d.p + 2 > tok_d.end) ||
-       (tok_m.p + 2 > tok_m.end) ||
-       (tok_y.p + 4 > tok_y.end) )
-        return -1;
-    r->utc_day = str2int(tok_d.p,   tok_d.p+2);
-    r->utc_mon = str2int(tok_m.p, tok_m.p+2);
-    r->utc_year = str2int(tok_y.p, tok_y.end+4);
-    return 0;
-}
+static int64_t gps_system_ms(void);
 
-static int nmea_reader_update_date( NmeaReader*  r, Token  date, Token  time )
+/* whether the receiver still has usable ephemeris from its last fix, as
+ * far as the cache knows. it then needs no help to start.
+ */
+static int gps_state_ephemeris_recent( GpsState*  state )
 {
-    Token  tok = date;
-    int    day, mon, year;
-    if (tok.p + 6 != tok.end) 
-    {
-        D("date not properly formatted: '%.*s'", tok.end-tok.p, tok.p);
-        return -1;
-    }
-    day  = str2int(tok.p, tok.p+2);
-    mon  = str2int(tok.p+2, tok.p+4);
-    year = str2int(tok.p+4, tok.p+6) + 2000;
-    if ((day|mon|year) < 0) 
-    {
-        D("date not properly formatted: '%.*s'", tok.end-tok.p, tok.p);
-        return -1;
-    }
-    r->utc_year  = year;
-    r->utc_mon   = mon;
-    r->utc_day   = day;
-    return nmea_reader_update_time( r, time );
-}
-
+    GpsCacheEntry*  e = &state->cache_entry;
+    int64_t         age;
 
-static double convert_from_hhmm( Token  tok )
-{
-    double  val     = str2float(tok.p, tok.end);
-    int     degrees = (int)(floor(val) / 100);
-    double  minutes = val - degrees*100.;
-    double  dcoord  = degrees + minutes / 60.0;
-    return dcoord;
+    if (!(e->flags & GPS_CACHE_HAS_FIX) || !(e->flags & GPS_CACHE_HAS_SV) ||
+        e->ephemeris_mask == 0)
+        return 0;
+    age = gps_system_ms() - e->fix_time;
+    if (e->flags & GPS_CACHE_HAS_TIME)
+        age += e->time_offset;
+    return age >= 0 && age < GPS_CACHE_EPHEMERIS_MS;
 }
 
-
-static int nmea_reader_update_latlong( NmeaReader*  r,
-                            Token        latitude,
-                            char         latitudeHemi,
-                            Token        longitude,
-                            char         longitudeHemi )
+/* hot start the receiver from the aiding data. each reset restarts the
+ * receiver's search, so this is done once per session, before it has
+ * output a position since power-on, and not at all while its ephemeris is
+ * recent. later aiding data is only kept for the next session. without an
+ * injected time the system clock, normally set from the network, is good
+ * enough.
+ */
+static void gps_state_inject_aiding( GpsState*  state )
 {
-    double   lat, lon;
-    Token    tok;
-    tok = latitude;
-    if (tok.p + 6 > tok.end)
+    GpsAiding    aid;
+    GpsUtcTime   utc;
+
+    if (state->init != STATE_START || state->aiding_injected)
+        return;
+    if (state->position_seen)
     {
-        D("latitude is too short: '%.*s'", tok.end-tok.p, tok.p);
-        return -1;
+        D("receiver has a position, not injecting aiding data");
+        return;
     }
-    lat = convert_from_hhmm(tok);
-    if (latitudeHemi == 'S')
-        lat = -lat;
-    tok = longitude;
-    if (tok.p + 6 > tok.end)
+    if (gps_state_ephemeris_recent( state ))
     {
-        D("longitude is too short: '%.*s'", tok.end-tok.p, tok.p);
-        return -1;
+        D("receiver has recent ephemeris, not injecting aiding data");
+        state->aiding_injected = 1;
+        return;
     }
-    lon = convert_from_hhmm(tok);
-    if (longitudeHemi == 'W')
-        lon = -lon;
-
-    r->fix.flags    |= GPS_LOCATION_HAS_LAT_LONG;
-    r->fix.latitude  = lat;
-    r->fix.longitude = lon;
-    return 0;
-}
 
+    pthread_mutex_lock( &state->aiding_lock );
+    aid = state->aiding;
+    pthread_mutex_unlock( &state->aiding_lock );
 
-static int nmea_reader_update_altitude( NmeaReader*  r,
-                             Token        altitude,
-                             Token        units )
-{
-    double  alt;
-    Token   tok = altitude;
-   if (tok.p >= tok.end)
-       return -1;
-   r->fix.flags   |= GPS_LOCATION_HAS_ALTITUDE;
-   r->fix.altitude = str2float(tok.p, tok.end);
-   return 0;
-}
+    if (!aid.location_valid)
+        return;
 
-static int nmea_reader_update_accuracy( NmeaReader*  r,
-                             Token        accuracy )
-{
-    double  acc;
-    Token   tok = accuracy;
-    if (tok.p >= tok.end)
-        return -1;
-    r->fix.accuracy = str2float(tok.p, tok.end);
-    if (r->fix.accuracy == 99.99)
+    if (aid.time_valid)
     {
-        return 0;
+        utc = aid.time + (gps_monotonic_ms() - aid.time_ref);
+    } else
+    {
+        struct timeval  tv;
+        gettimeofday( &tv, NULL );
+        utc = (GpsUtcTime)tv.tv_sec * 1000 + tv.tv_usec / 1000;
     }
-    r->fix.flags |= GPS_LOCATION_HAS_ACCURACY;
-    return 0;
+    DFR("gps injecting position %.4f %.4f, %s time",
+        aid.latitude, aid.longitude, aid.time_valid ? "injected" : "system");
+    gps_dev_inject( &state->dev, aid.latitude, aid.longitude, aid.altitude, utc );
+    state->aiding_injected = 1;
 }
 
-static int nmea_reader_update_bearing( NmeaReader*  r,
-                            Token        bearing )
+static int64_t gps_system_ms(void)
 {
-    double  alt;
-    Token   tok = bearing;
-    if (tok.p >= tok.end)
-        return -1;
-    r->fix.flags   |= GPS_LOCATION_HAS_BEARING;
-    r->fix.bearing  = str2float(tok.p, tok.end);
-    return 0;
+    struct timeval  tv;
+    gettimeofday( &tv, NULL );
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-
-static int nmea_reader_update_speed( NmeaReader*  r,
-                          Token        speed )
+/* open the cache and use its last fix as aiding data, unless the framework
+ * already injected some. the receiver's offset from the system clock,
+ * measured at that fix, corrects the time. nothing is used if the cache is
+ * too old, or newer than the system clock, which then isn't set yet.
+ */
+static void gps_state_load_cache( GpsState*  state )
 {
-    double  alt;
-    Token   tok = speed;
-
-    if (tok.p >= tok.end)
-        return -1;
-    r->fix.flags   |= GPS_LOCATION_HAS_SPEED;
-    r->fix.speed    = str2float(tok.p, tok.end) * 0.514444;   // change to m/s
-    return 0;
-}
+    char           path[PROPERTY_VALUE_MAX];
+    GpsCacheEntry  entry;
+    int64_t        now, age;
 
+    property_get("gps.cache.file", path, GPS_CACHE_DEFAULT_FILE);
+    if (gps_cache_init( &state->cache, path ) < 0 ||
+        gps_cache_load( &state->cache, &entry ) < 0)
+        return;
 
-static void nmea_reader_parse( NmeaReader*  r )
-{
-	D("nmea_reader_parse IN");
-/* we received a complete sentence, now parse it to generate
-    * a new GPS fix...
- */
-    NmeaTokenizer  tzer[1];
-    Token          tok;
-    D("Received: '%.*s'", r->pos, r->in);
-    if (r->pos < 9)
+    state->cache_entry = entry;
+    now = gps_system_ms();
+    age = now - entry.saved;
+    if (!(entry.flags & GPS_CACHE_HAS_FIX) || age < 0 || age > GPS_CACHE_MAX_AGE_MS)
     {
-        D("Too short. discarded.");
+        DFR("gps cache not used, flags 0x%x, age %lld s", entry.flags, (long long)(age / 1000));
         return;
     }
-    nmea_tokenizer_init(tzer, r->in, r->in + r->pos);
-#if GPS_DEBUG
+
+    pthread_mutex_lock( &state->aiding_lock );
+    if (!state->aiding.location_valid)
     {
-        int  n;
-        D("Found %d tokens", tzer->count);
-        for (n = 0; n < tzer->count; n++)
-        {
-            Token  tok = nmea_tokenizer_get(tzer,n);
-            D("%2d: '%.*s'", n, tok.end-tok.p, tok.p);
-        }
+        state->aiding.latitude       = entry.latitude;
+        state->aiding.longitude      = entry.longitude;
+        state->aiding.altitude       = entry.altitude;
+        state->aiding.location_valid = 1;
     }
-#endif
-    tok = nmea_tokenizer_get(tzer, 0);
-    if (tok.p + 5 > tok.end)
+    if (!state->aiding.time_valid && (entry.flags & GPS_CACHE_HAS_TIME))
     {
-        D("sentence id '%.*s' too short, ignored.", tok.end-tok.p, tok.p);
-        return;
+        state->aiding.time       = now + entry.time_offset;
+        state->aiding.time_ref   = gps_monotonic_ms();
+        state->aiding.time_valid = 1;
     }
-// ignore first two characters.
-    tok.p += 2;
-    if ( !memcmp(tok.p, "GGA", 3) ) 
-    {
-// GPS fix
-        D("GGA parser IN");
-        Token  tok_fixstaus      = nmea_tokenizer_get(tzer,6);
-        if (tok_fixstaus.p[0] > '0') 
-        {
-            Token  tok_time          = nmea_tokenizer_get(tzer,1);
-            Token  tok_latitude      = nmea_tokenizer_get(tzer,2);
-            Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,3);
-            Token  tok_longitude     = nmea_tokenizer_get(tzer,4);
-            Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,5);
-            Token  tok_usedInfix = nmea_tokenizer_get(tzer,7);
-            Token  tok_altitude      = nmea_tokenizer_get(tzer,9);
-            Token  tok_altitudeUnits = nmea_tokenizer_get(tzer,10);
-            nmea_reader_update_time(r, tok_time);
-            nmea_reader_update_latlong(r, tok_latitude,
-                                      tok_latitudeHemi.p[0],
-                                      tok_longitude,
-                                      tok_longitudeHemi.p[0]);
-            nmea_reader_update_altitude(r, tok_altitude, tok_altitudeUnits);
-            r->sv_status.num_used_svs = str2int(tok_usedInfix.p, tok_usedInfix.end);
-        }
-
-    } else if ( !memcmp(tok.p, "GLL", 3) ) {
-		D("GLL parser IN");
-        Token  tok_fixstaus      = nmea_tokenizer_get(tzer,6);
-        if (tok_fixstaus.p[0] == 'A') 
-        {
-            Token  tok_latitude      = nmea_tokenizer_get(tzer,1);
-            Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,2);
-            Token  tok_longitude     = nmea_tokenizer_get(tzer,3);
-			Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,4);
-			Token  tok_time          = nmea_tokenizer_get(tzer,5);
-			nmea_reader_update_time(r, tok_time);
-			nmea_reader_update_latlong(r, tok_latitude,
-                                              tok_latitudeHemi.p[0],
-                                              tok_longitude,
-                                              tok_longitudeHemi.p[0]);
-		}
- 
-    } else if ( !memcmp(tok.p, "GSA", 3) ){
-	    D("GSA parser IN");
-		Token  tok_fixStatus   = nmea_tokenizer_get(tzer, 2);
-		int i;
-		if (tok_fixStatus.p[0] != '\0' && tok_fixStatus.p[0] != '1') 
-		{
-		    Token  tok_accuracy      = nmea_tokenizer_get(tzer, 15);
-			nmea_reader_update_accuracy(r, tok_accuracy);
-			r->sv_status.used_in_fix_mask = 0ul;
-			for (i = 3; i <= 14; ++i)
-			{
-                Token  tok_prn  = nmea_tokenizer_get(tzer, i);
-                int prn = str2int(tok_prn.p, tok_prn.end);
-                if (prn > 0 && prn < 32)
-                {
-                    r->sv_status.used_in_fix_mask |= (1ul << (prn-1));
-                    r->sv_status_changed = 1;
-                    D("%s: fix mask is %s, %d", __FUNCTION__, r->sv_status.used_in_fix_mask);
-                }
-            }
-
-        }
-
-    } else if ( !memcmp(tok.p, "GSV", 3) ) {
-		D("GSV parser IN");
-		Token  tok_noSatellites  = nmea_tokenizer_get(tzer, 3);
-		int    noSatellites = str2int(tok_noSatellites.p, tok_noSatellites.end);
-		if (noSatellites > 0) 
-        {
-            Token  tok_noSentences   = nmea_tokenizer_get(tzer, 1);
-			Token  tok_sentence      = nmea_tokenizer_get(tzer, 2);
-			int sentence = str2int(tok_sentence.p, tok_sentence.end);
-			int totalSentences = str2int(tok_noSentences.p, tok_noSentences.end);
-			int curr;
-			int i;
-			if (sentence == 1) 
-			{
-                r->sv_status_changed = 0;
-                r->sv_status.num_svs = 0;
-            }
-			curr = r->sv_status.num_svs;
-			i = 0;
-			while (i < 4 && r->sv_status.num_svs < noSatellites)
-			{
-                Token  tok_prn = nmea_tokenizer_get(tzer, i * 4 + 4);
-                Token  tok_elevation = nmea_tokenizer_get(tzer, i * 4 + 5);
-                Token  tok_azimuth = nmea_tokenizer_get(tzer, i * 4 + 6);
-                Token  tok_snr = nmea_tokenizer_get(tzer, i * 4 + 7);
-				r->sv_status.sv_list[curr].prn = str2int(tok_prn.p, tok_prn.end);
-				r->sv_status.sv_list[curr].elevation = str2float(tok_elevation.p, tok_elevation.end);
-				r->sv_status.sv_list[curr].azimuth = str2float(tok_azimuth.p, tok_azimuth.end);
-				r->sv_status.sv_list[curr].snr = str2float(tok_snr.p, tok_snr.end);
-				r->sv_status.num_svs += 1;
-				curr += 1;
-				i += 1;
-			}
-
-			if (sentence == totalSentences)
-			{
-                r->sv_status_changed = 1;
-            }
+    pthread_mutex_unlock( &state->aiding_lock );
 
-            D("%s: GSV message with total satellites %d", __FUNCTION__, noSatellites);   
-
-        }
-
-    } else if ( !memcmp(tok.p, "RMC", 3) ) {
-        D("RMC parser IN");
-        Token  tok_fixStatus     = nmea_tokenizer_get(tzer,2);
-		if (tok_fixStatus.p[0] == 'A')
-		{
-        
-			Token  tok_time          = nmea_tokenizer_get(tzer,1);
-            Token  tok_latitude      = nmea_tokenizer_get(tzer,3);
-            Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,4);
-            Token  tok_longitude     = nmea_tokenizer_get(tzer,5);
-            Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,6);
-            Token  tok_speed         = nmea_tokenizer_get(tzer,7);
-            Token  tok_bearing       = nmea_tokenizer_get(tzer,8);
-            Token  tok_date          = nmea_tokenizer_get(tzer,9);
-            nmea_reader_update_date( r, tok_date, tok_time );
-            nmea_reader_update_latlong( r, tok_latitude,
-                                              tok_latitudeHemi.p[0],
-                                              tok_longitude,
-                                              tok_longitudeHemi.p[0] );
-  
-            nmea_reader_update_bearing( r, tok_bearing );
-            nmea_reader_update_speed  ( r, tok_speed );
-        }
-
-    } else if ( !memcmp(tok.p, "VTG", 3) ) {
-        D("VTG parser IN");
-		Token  tok_fixStatus     = nmea_tokenizer_get(tzer,9);
-		if (tok_fixStatus.p[0] != '\0' && tok_fixStatus.p[0] != 'N')
-		{
-            Token  tok_bearing       = nmea_tokenizer_get(tzer,1);
-			Token  tok_speed         = nmea_tokenizer_get(tzer,5);
-			nmea_reader_update_bearing( r, tok_bearing );
-			nmea_reader_update_speed  ( r, tok_speed );
-		}
-
-    } else if ( !memcmp(tok.p, "ZDA", 3) ) {
-        D("ZDA parser IN");
-        Token  tok_time;
-		Token  tok_year  = nmea_tokenizer_get(tzer,4);
-		if (tok_year.p[0] != '\0') 
-		{
-		    Token  tok_day   = nmea_tokenizer_get(tzer,2);
-			Token  tok_mon   = nmea_tokenizer_get(tzer,3);
-			nmea_reader_update_cdate( r, tok_day, tok_mon, tok_year );
-		}
-        tok_time  = nmea_tokenizer_get(tzer,1);
-		if (tok_time.p[0] != '\0') 
-		{
-	        nmea_reader_update_time(r, tok_time);
-		}
-    } else {
-        tok.p -= 2;
-        D("unknown sentence '%.*s", tok.end-tok.p, tok.p);
-    }
+    DFR("gps cache: fix %lld s old, time offset %lld ms, %d svs with ephemeris",
+        (long long)(age / 1000), (long long)entry.time_offset, __builtin_popcount(entry.ephemeris_mask));
+}
 
-    if (!gps_state->first_fix &&
-        gps_state->init == STATE_INIT &&
-        r->fix.flags & GPS_LOCATION_HAS_LAT_LONG) 
-    {
+/* write the last fix and the satellites in view to the cache. during a
+ * session this happens at most every GPS_CACHE_SAVE_MS, 'force' writes
+ * right away.
+ */
+static void gps_state_save_cache( GpsState*  state, int  force )
+{
+    int64_t  now = gps_monotonic_ms();
 
-	    if (gps_state->callbacks.location_cb) 
-        {
-            gps_state->callbacks.location_cb( &r->fix );
-            r->fix.flags = 0;
-        }
-        gps_state->first_fix = 1;
-    }
+    if (!state->cache_dirty)
+        return;
+    if (!force && now - state->cache.last_save < GPS_CACHE_SAVE_MS)
+        return;
 
-#if 0
-    if (r->fix.flags != 0) {
-#if GPS_DEBUG
-        char   temp[256];
-        char*  p   = temp;
-        char*  end = p + sizeof(temp);
-        struct tm   utc;
-
-        p += snprintf( p, end-p, "sending fix" );
-        if (r->fix.flags & GPS_LOCATION_HAS_LAT_LONG) {
-            p += snprintf(p, end-p, " lat=%g lon=%g", r->fix.latitude, r->fix.longitude);
-        }
-        if (r->fix.flags & GPS_LOCATION_HAS_ALTITUDE) {
-            p += snprintf(p, end-p, " altitude=%g", r->fix.altitude);
-        }
-        if (r->fix.flags & GPS_LOCATION_HAS_SPEED) {
-            p += snprintf(p, end-p, " speed=%g", r->fix.speed);
-        }
-        if (r->fix.flags & GPS_LOCATION_HAS_BEARING) {
-            p += snprintf(p, end-p, " bearing=%g", r->fix.bearing);
-        }
-        if (r->fix.flags & GPS_LOCATION_HAS_ACCURACY) {
-            p += snprintf(p,end-p, " accuracy=%g", r->fix.accuracy);
-        }
-        gmtime_r( (time_t*) &r->fix.timestamp, &utc );
-        p += snprintf(p, end-p, " time=%s", asctime( &utc ) );
-        D(temp);
-#endif
-        if (r->callback) {
-            r->callback( &r->fix );
-            r->fix.flags = 0;
-        }
-        else {
-            D("no callback, keeping data until needed !");
-        }
-    }
-#endif
+    gps_cache_set_sv( &state->cache_entry, &state->snapshot.sv );
+    gps_cache_save( &state->cache, &state->cache_entry );
+    state->cache.last_save = now;
+    state->cache_dirty = 0;
 }
 
-static int fd_gpslog = -1;
-static int fd_flag;
-static char charFormart[30];
-
-static void nmea_reader_addc( NmeaReader*  r, int  c )
+/* the sentences the registered callbacks need, the receiver is told to
+ * leave out the rest. GLL, VTG and ZDA repeat what GGA and RMC carry, GSV
+ * is only needed for satellite status. nmea_cb gets whatever is left.
+ */
+static unsigned gps_state_sentences( GpsState*  s )
 {
-    char p[30];
-    char tmp[16];
-    if (r->overflow) 
-    {
-        r->overflow = (c != '\n');
-        return;
-    }
+    unsigned  sentences = GPS_DEV_GGA | GPS_DEV_RMC;
+
+    if (s->callbacks.location_cb)
+        sentences |= GPS_DEV_GSA;       /* accuracy */
+    if (s->callbacks.sv_status_cb || s->sv_ext_callbacks.sv_ext_status_cb ||
+        s->sv_delta_callbacks.sv_delta_cb)
+        sentences |= GPS_DEV_GSA | GPS_DEV_GSV;
+    return sentences;
+}
 
-    if (r->pos >= (int) sizeof(r->in)-1 ) 
-    {
-        r->overflow = 1;
-        r->pos      = 0;
-        return;
-    }
-    r->in[r->pos] = (char)c;
-    r->pos       += 1;
-    if (c == '\n') 
+/* tell the gps thread that the callbacks changed */
+static void gps_state_update_callbacks(GpsState *s)
+{
+    char  cmd = CMD_CALLBACKS;
+    int   ret;
+    do {
+        ret=write( s->control[0], &cmd, 1 );
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1)
     {
-        GPS_STATE_LOCK_FIX(gps_state);
-        nmea_reader_parse( r );
-        GPS_STATE_UNLOCK_FIX(gps_state);
-        if(property_get("sys.gps.log", tmp, NULL) && strncmp(tmp,"on",2) == 0)
-//    	  if(1)
-	    {
-		//	if ((fd_gpslog == 0 && !fd_flag) || fd_gpslog == -1)
-            if (fd_gpslog == -1)
-            {
-	            time_t now;
-	            struct tm *timenow;
-                time(&now);
-	            timenow = (struct tm*)localtime(&now);
-	            sprintf(charFormart,"\/sdcard\/%4.4d-%2.2d-%2.2d-%2.2d%2.2d.log",
-	                timenow->tm_year + 1900,
-		            timenow->tm_mon + 1,
-		            timenow->tm_mday,
-		            timenow->tm_hour,
-		            timenow->tm_min
-		            );
-	            fd_gpslog = open(charFormart,O_WRONLY|O_CREAT|O_APPEND);
-	            if (fd_gpslog == -1) DFR("open log file failed\n");
-//				if (fd_gpslog == -1) DFR(tmp);
-	       }
-	       DFR("fd_gpslog",fd_gpslog);
-           if (fd_gpslog == -1) goto xxx;
-//			sprintf(p, "time = %llu\n", r->fix.timestamp);
-//			write(fd_gpslog, p, strlen(p) + 1); 
-		   write(fd_gpslog, r->in, r->pos); 
-        } else {
-            if(fd_gpslog != -1)  
-            {
-                close(fd_gpslog);fd_gpslog = -1;
-            }
-        }
-xxx:
-        r->pos = 0;
-//		DFR(tmp);
+        D("%s: could not send CMD_CALLBACKS command: ret=%d: %s",
+           __FUNCTION__, ret, strerror(errno));
     }
 }
 
-/*****************************************************************/
-/*****************************************************************/
-/*****                                                       *****/
-/*****       C O N N E C T I O N   S T A T E *****/
-/*****                                                       *****/
-/*****************************************************************/
-/*****************************************************************/
-
-/* commands sent to the gps thread */
-enum {
-    CMD_QUIT  = 0,
-    CMD_START = 1,
-    CMD_STOP  = 2
-};
-
-static void gps_state_update_fix_freq(GpsState *s, int fix_freq)
+/* set the time between fixes, in ms. the gps thread picks it up and
+ * re-arms its fix timer right away.
+ */
+static void gps_state_update_fix_interval(GpsState *s, int fix_interval)
 {
-    D("gps_state_update_fix_freq In");
-    s->fix_freq = fix_freq;
-    D("gps_state_update_fix_freq out");
-    return;
-
+    D("gps_state_update_fix_interval In");
+    char  cmd = CMD_INTERVAL;
+    int   ret;
+    s->fix_interval = fix_interval;
+    do {
+        ret=write( s->control[0], &cmd, 1 );
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1)
+    {
+        D("%s: could not send CMD_INTERVAL command: ret=%d: %s",
+           __FUNCTION__, ret, strerror(errno));
+    }
+    D("gps_state_update_fix_interval out");
 }
 
 
@@ -775,15 +653,18 @@ static void gps_state_done( GpsState*  s )
 
     DFR("gps waiting for command thread to stop");
     pthread_join(s->thread, &dummy);
-/* Timer thread depends on this state check */
+// the gps thread was the only producer, flush what it queued
+    if (s->dispatch.callbacks)
+        gps_dispatch_done(&s->dispatch);
+    gps_logger_done(&s->logger);
     s->init = STATE_QUIT;
-    s->fix_freq = -1;
+    s->fix_interval = -1;
 // close the control socket pair
     close( s->control[0] ); s->control[0] = -1;
     close( s->control[1] ); s->control[1] = -1;
 // close connection to the QEMU GPS daemon
     close( s->fd ); s->fd = -1;
-    sem_destroy(&s->fix_sem);
+    pthread_mutex_destroy(&s->aiding_lock);
     memset(s, 0, sizeof(*s));
     DFR("gps deinit complete");
     D("gps_state_done out");
@@ -825,14 +706,14 @@ static void gps_state_stop( GpsState*  s )
 }
 
 
-static int epoll_register( int  epoll_fd, int  fd )
+static int epoll_register( int  epoll_fd, int  fd, unsigned  events )
 {
     struct epoll_event  ev;
     int                 ret, flags;
 /* important: make the fd non-blocking */
     flags = fcntl(fd, F_GETFL);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    ev.events  = EPOLLIN;
+    ev.events  = events;
     ev.data.fd = fd;
     do {
            ret = epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &ev );
@@ -858,35 +739,275 @@ static int epoll_deregister( int  epoll_fd, int  fd )
 static int gps_power_on(void);
 static int gps_power_off(void);
 
-static struct timeval get_time_now(void);
-static struct timeval t0;
-static struct timeval t1;
-static unsigned long time_div;
-static unsigned int first_fix_location;
+/* arm the fix timer for the current interval, or disarm it. the first
+ * expiry is immediate so that a new session gets its first fix as soon as
+ * the receiver has one.
+ */
+static void gps_timer_arm( GpsState*  state, int  timer_fd, int  started )
+{
+    struct itimerspec  its;
+    int                ms = state->fix_interval;
+
+    memset(&its, 0, sizeof(its));
+    if (started && ms >= 0)
+    {
+        its.it_value.tv_nsec    = 1;
+        its.it_interval.tv_sec  = ms / 1000;
+        its.it_interval.tv_nsec = (ms % 1000) * 1000000;
+    }
+    if (timerfd_settime( timer_fd, 0, &its, NULL ) < 0)
+        LOGE("could not arm gps fix timer: %s", strerror(errno));
+    D("gps fix timer %s, interval %d ms", its.it_value.tv_nsec ? "armed" : "disarmed", ms);
+}
+
+/* remember the rate the receiver is at, the next gps_dev_init() tries it
+ * first
+ */
+static void gps_state_note_baud( GpsState*  state )
+{
+    uint32_t  bps = gps_dev_bps( &state->dev );
+
+    if (state->cache_entry.baud != bps)
+    {
+        state->cache_entry.baud = bps;
+        state->cache_dirty = 1;
+    }
+}
+
+/* power the receiver on and bring it to the mode and sentences in use.
+ * with 'resume', it was powered off with its settings as they are in
+ * state->dev, which are kept if it still answers to them.
+ */
+static void gps_state_power_up( GpsState*  state, int  gps_fd, int  resume )
+{
+    gps_power_on();
+    state->aiding_injected = 0;
+    state->position_seen   = 0;
+    if (resume && gps_dev_resume( &state->dev ) == 0)
+        return;
+    if (gps_dev_init( &state->dev, gps_fd, state->cache_entry.baud ) == 0 &&
+        state->protocol == GPS_DEV_SIRF)
+        gps_dev_set_protocol( &state->dev, GPS_DEV_SIRF );
+    gps_dev_set_sentences( &state->dev, gps_state_sentences(state) );
+    gps_state_note_baud( state );
+}
+
+/* whether the receiver may be powered off between the fixes of a session */
+static int gps_duty_enabled( GpsState*  state, int  started )
+{
+    return started && !state->duty.fallback &&
+           state->fix_interval >= GPS_DUTY_MIN_INTERVAL;
+}
+
+/* the interval the receiver outputs at. when it is powered off between
+ * fixes, it should get the next one as soon as it can.
+ */
+static int gps_duty_dev_interval( GpsState*  state, int  started )
+{
+    return gps_duty_enabled( state, started ) ? 1000 : state->fix_interval;
+}
+
+/* power the receiver back on at the rate and protocol it had. what the
+ * parsers held is stale. it was tracking before, so it normally still has
+ * its ephemeris and needs nothing else. otherwise the last fix and the
+ * receiver's clock offset make it a hot start.
+ */
+static void gps_duty_wake( GpsState*  state, NmeaFramer*  framer, int  gps_fd,
+                           int  power_fd, int  started )
+{
+    struct itimerspec  its;
+    GpsCacheEntry*     last = &state->cache_entry;
+
+    if (!state->duty.off)
+        return;
+
+    memset(&its, 0, sizeof(its));
+    timerfd_settime( power_fd, 0, &its, NULL );
+    state->duty.off        = 0;
+    state->duty.wake_time  = gps_monotonic_ms();
+    state->duty.reacquired = 0;
+    D("gps duty: powering on");
+
+    gps_state_power_up( state, gps_fd, 1 );
+    nmea_framer_reset( framer );
+    sirf_reader_init( &state->sirf );
+    sirf_reader_set_callback( &state->sirf, sirf_reader_epoch, state );
+    if (started)
+        gps_dev_start( &state->dev, gps_duty_dev_interval(state, started) );
+
+    if ((last->flags & GPS_CACHE_HAS_FIX) && !gps_state_ephemeris_recent( state ))
+    {
+        gps_dev_inject( &state->dev, last->latitude, last->longitude, last->altitude,
+                        gps_system_ms() + ((last->flags & GPS_CACHE_HAS_TIME) ?
+                                           last->time_offset : 0) );
+    }
+    state->aiding_injected = 1;
+}
+
+/* called once a chunk has been read. at the first position since the
+ * receiver was powered on, measure how long it took to reacquire. after a
+ * fix was delivered, power it off if the next fix is far enough away. the
+ * next wake-up leaves the estimated reacquisition time plus
+ * GPS_DUTY_MARGIN_MS. the estimate moves half way towards a slower
+ * measurement and a quarter towards a faster one, so a single slow start
+ * doesn't turn duty cycling off.
+ */
+static void gps_duty_update( GpsState*  state, int  timer_fd, int  power_fd, int  started )
+{
+    struct itimerspec  its;
+    int64_t            next, wake_in;
+    int                lead;
+
+    if (state->duty.reacquired)
+    {
+        int  reacq = (int)(gps_monotonic_ms() - state->duty.wake_time);
+
+        if (reacq > state->duty.reacq)
+            state->duty.reacq = (state->duty.reacq + reacq) / 2;
+        else
+            state->duty.reacq = (3 * state->duty.reacq + reacq) / 4;
+        state->duty.wake_time  = 0;
+        state->duty.reacquired = 0;
+        DFR("gps duty: reacquired in %d ms, estimate %d ms", reacq, state->duty.reacq);
+    }
+
+    if (!state->duty.fix_delivered)
+        return;
+    state->duty.fix_delivered = 0;
+
+    if (!gps_duty_enabled( state, started ))
+        return;
+
+    lead = state->duty.reacq + GPS_DUTY_MARGIN_MS;
+    if (lead + GPS_DUTY_MIN_SLEEP_MS > state->fix_interval)
+    {
+        DFR("gps duty: reacquisition takes %d ms, staying on for %d ms fixes",
+            state->duty.reacq, state->fix_interval);
+        state->duty.fallback = 1;
+        gps_dev_start( &state->dev, state->fix_interval );
+        return;
+    }
+
+    if (timerfd_gettime( timer_fd, &its ) < 0)
+        return;
+    next    = (int64_t)its.it_value.tv_sec * 1000 + its.it_value.tv_nsec / 1000000;
+    wake_in = next - lead;
+    if (wake_in < GPS_DUTY_MIN_SLEEP_MS)
+        return;
+
+    /* what the receiver knew, to tell on wake-up whether it still has
+     * its ephemeris. the port settings stay as they are, see
+     * gps_dev_resume().
+     */
+    gps_cache_set_sv( &state->cache_entry, &state->snapshot.sv );
+
+    D("gps duty: powering off for %lld ms", (long long)wake_in);
+    gps_power_off();
+    state->duty.off     = 1;
+    state->duty.sleeps += 1;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = wake_in / 1000;
+    its.it_value.tv_nsec = (wake_in % 1000) * 1000000;
+    if (timerfd_settime( power_fd, 0, &its, NULL ) < 0)
+        LOGE("could not arm gps power timer: %s", strerror(errno));
+}
+
+/* read what the receiver sent and feed it to the parser. in legacy mode
+ * this is a single read(), otherwise the port is drained until EAGAIN as
+ * edge-triggered epoll requires. returns the number of bytes read.
+ */
+static int gps_state_read( GpsState*  state, NmeaFramer*  framer, int  fd )
+{
+    GpsReadStats*  stats = &state->read_stats;
+    int            total = 0;
+
+    for (;;)
+    {
+        char             buf[512];
+        struct timeval   tv;
+        int              ret;
+
+        do {
+            ret = read( fd, buf, sizeof(buf) );
+        } while (ret < 0 && errno == EINTR);
+        stats->reads += 1;
+
+        if (ret <= 0)
+        {
+            if (ret < 0 && errno != EAGAIN)
+                LOGE("could not read gps device: %s", strerror(errno));
+            break;
+        }
+        gettimeofday( &tv, NULL );
+        state->rx_time = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        state->rx_mono = gps_metrics_now();
+        gps_logger_write( &state->logger, state->rx_mono, buf, ret );
+        if (state->dev.protocol == GPS_DEV_SIRF)
+            sirf_reader_feed( &state->sirf, buf, ret );
+        else
+            nmea_framer_feed( framer, buf, ret );
+        state->parse_time += gps_metrics_now() - state->rx_mono;
+        stats->bytes += ret;
+        total += ret;
+
+        if (state->read_mode == GPS_READ_LEGACY)
+            break;
+    }
+    /* a whole chunk has been parsed, deliver what it completed */
+    if (total > 0)
+    {
+        if (state->epoch_done)
+        {
+            gps_histogram_add( &gps_metrics.parse, state->parse_time );
+            state->parse_time = 0;
+            state->epoch_done = 0;
+        }
+        gps_state_deliver( state );
+        gps_state_save_cache( state, 0 );
+    }
+    return total;
+}
+
 
 static void* gps_state_thread( void*  arg )
 {
     D("gps_state_thread IN");
     GpsState*   state = (GpsState*) arg;
     NmeaReader  *reader;
-    int         epoll_fd   = epoll_create(2);
+    NmeaFramer  framer[1];
+    int         epoll_fd   = epoll_create(4);
     int         started    = 0;
     int         gps_fd     = state->fd;
     int         control_fd = state->control[1];
+    int         timer_fd   = timerfd_create(CLOCK_MONOTONIC, 0);
+    int         power_fd   = timerfd_create(CLOCK_MONOTONIC, 0);
+    int         timeout    = -1;
+    unsigned    fix_seq    = 0;
     reader = &state->reader;
     nmea_reader_init( reader );
+    /* the UART link is noisy, don't let corrupted sentences through */
+    nmea_reader_set_checksum_mode( reader, NMEA_CHECKSUM_VERIFY );
+    nmea_reader_set_callback( reader, nmea_reader_epoch, state );
+    nmea_framer_init( framer, nmea_reader_sentence, reader );
+    sirf_reader_init( &state->sirf );
+    sirf_reader_set_callback( &state->sirf, sirf_reader_epoch, state );
 // register control file descriptors for polling
-    epoll_register( epoll_fd, control_fd );
-    epoll_register( epoll_fd, gps_fd );
+    epoll_register( epoll_fd, control_fd, EPOLLIN );
+    epoll_register( epoll_fd, gps_fd, state->read_mode == GPS_READ_LEGACY ?
+                                      EPOLLIN : EPOLLIN|EPOLLET );
+    epoll_register( epoll_fd, timer_fd, EPOLLIN );
+    epoll_register( epoll_fd, power_fd, EPOLLIN );
     D("gps thread running");
-    gps_power_on();
-    t0 = get_time_now();
+    state->duty.reacq = GPS_DUTY_INITIAL_REACQ;
+    gps_state_load_cache( state );
+    gps_state_power_up( state, gps_fd, 0 );
     // now loop
     for (;;) 
     {
-        struct epoll_event   events[2];
+        struct epoll_event   events[4];
         int                  ne, nevents;
-        nevents = epoll_wait( epoll_fd, events, 2, -1 );
+        nevents = epoll_wait( epoll_fd, events, 4, timeout );
         if (nevents < 0) 
         {
             if (errno != EINTR)
@@ -896,6 +1017,18 @@ static void* gps_state_thread( void*  arg )
            
             continue;
         }
+        if (nevents == 0)
+        {
+            /* GPS_READ_IDLE_MS since the last read, less than VMIN bytes
+             * may be waiting. keep polling until a read finds nothing.
+             */
+            state->read_stats.wakeups    += 1;
+            state->read_stats.idle_reads += 1;
+            if (gps_state_read( state, framer, gps_fd ) <= 0)
+                timeout = -1;
+            gps_duty_update( state, timer_fd, power_fd, started );
+            continue;
+        }
 // D("gps thread received %d events", nevents);
         for (ne = 0; ne < nevents; ne++) 
         {
@@ -927,79 +1060,113 @@ static void* gps_state_thread( void*  arg )
                         {
                             D("gps thread starting  location_cb=%p", state->callbacks.location_cb);
                             started = 1;
-//  gps_dev_start(gps_fd);
-                            GPS_STATUS_CB(state->callbacks, GPS_STATUS_SESSION_BEGIN);
-                            state->init = STATE_START;
-                            if ( pthread_create( &state->tmr_thread, NULL, gps_timer_thread, state ) != 0 ) 
-                            {
-                                LOGE("could not create gps timer thread: %s", strerror(errno));
-                                started = 0;
-                                state->init = STATE_INIT;
-                                goto Exit;
-                            }
-
+                            state->duty.fallback = 0;
+                            state->duty.sleeps   = 0;
+                            gps_dev_set_sentences( &state->dev, gps_state_sentences(state) );
+                            gps_dev_start( &state->dev, gps_duty_dev_interval(state, started) );
+                            GPS_STATUS_CB(state, GPS_STATUS_SESSION_BEGIN);
+                            state->init     = STATE_START;
+                            state->aiding_injected = 0;
+                            gps_state_inject_aiding( state );
+                            state->session_start = gps_metrics_now();
+                            state->fix_due  = 0;
+                            state->sv_due   = 0;
+                            state->sv_reports   = 0;
+                            state->sv_unchanged = 0;
+                            gps_sv_delta_reset( &state->sv_delta );
+                            nmea_batch_reset( &state->nmea );
+                            memset( &state->read_stats, 0, sizeof(state->read_stats) );
+                            fix_seq = state->snapshot.fix_seq;
+                            gps_timer_arm(state, timer_fd, started);
                          }
                     } else if (cmd == CMD_STOP) 
                     {
                         if (started) 
                         {
-                            void *dummy;
                             D("gps thread stopping");
                             started = 0;
-// gps_dev_stop(gps_fd);
+                            state->session_start = 0;
+                            gps_duty_wake( state, framer, gps_fd, power_fd, started );
+                            state->duty.wake_time  = 0;
+                            state->duty.reacquired = 0;
+                            gps_dev_stop( &state->dev );
+                            gps_state_flush_nmea( state );
+                            gps_state_save_cache( state, 1 );
                             state->init = STATE_INIT;
-                            pthread_join(state->tmr_thread, &dummy);
-                            GPS_STATUS_CB(state->callbacks, GPS_STATUS_SESSION_END);
+                            gps_timer_arm(state, timer_fd, started);
+                            GPS_STATUS_CB(state, GPS_STATUS_SESSION_END);
+                            DFR("gps nmea: %u sentences, %u malformed, %u ignored, %u bad checksum",
+                                reader->stats.sentences, reader->stats.malformed,
+                                reader->stats.ignored, reader->stats.bad_checksum);
+                            if (state->dev.protocol == GPS_DEV_SIRF)
+                                DFR("gps sirf: %u frames, %u bad checksum, %u bad length, %u ignored",
+                                    state->sirf.stats.frames, state->sirf.stats.bad_checksum,
+                                    state->sirf.stats.bad_length, state->sirf.stats.ignored);
+                            DFR("gps reads: %u wakeups (%u idle), %u reads, %u bytes, %u epochs",
+                                state->read_stats.wakeups, state->read_stats.idle_reads,
+                                state->read_stats.reads, state->read_stats.bytes,
+                                state->snapshot.fix_seq - fix_seq);
+                            DFR("gps sv: %u reports, %u unchanged",
+                                state->sv_reports, state->sv_unchanged);
+                            DFR("gps duty: %u power-offs, reacquisition %d ms%s",
+                                state->duty.sleeps, state->duty.reacq,
+                                state->duty.fallback ? ", fell back to continuous" : "");
                         }
+                    } else if (cmd == CMD_INTERVAL)
+                    {
+                        gps_timer_arm(state, timer_fd, started);
+                        if (!gps_duty_enabled( state, started ))
+                            gps_duty_wake( state, framer, gps_fd, power_fd, started );
+                        if (started && !state->duty.off)
+                            gps_dev_start( &state->dev, gps_duty_dev_interval(state, started) );
+                    } else if (cmd == CMD_CALLBACKS)
+                    {
+                        /* a new delta callback starts from the whole table */
+                        gps_sv_delta_reset( &state->sv_delta );
+                        if (!state->duty.off)
+                            gps_dev_set_sentences( &state->dev, gps_state_sentences(state) );
+                    } else if (cmd == CMD_AIDING)
+                    {
+                        /* a powered off receiver gets the last fix when it wakes,
+                         * otherwise only the first aiding of a session is sent
+                         */
+                        if (!state->duty.off)
+                            gps_state_inject_aiding( state );
                     }
-                } else if (fd == gps_fd)
+                } else if (fd == timer_fd)
                 {
-                    char buf[512];
-                    int  nn, ret;
+                    uint64_t  expirations;
+                    int       ret;
                     do {
-                        ret = read( fd, buf, sizeof(buf) );
+                        ret = read( fd, &expirations, sizeof(expirations) );
                     } while (ret < 0 && errno == EINTR);
 
-			        if (ret < 0) 
+                    /* the next complete epoch is due, not the ones
+                     * published before this point
+                     */
+                    if (state->fix_interval >= 0)
+                        state->fix_due = 1;
+                    state->sv_due   = 1;
+                    state->fix_seen = state->snapshot.fix_seq;
+                    state->sv_seen  = state->snapshot.sv_seq;
+                } else if (fd == power_fd)
+                {
+                    uint64_t  expirations;
+                    int       ret;
+                    do {
+                        ret = read( fd, &expirations, sizeof(expirations) );
+                    } while (ret < 0 && errno == EINTR);
+
+                    gps_duty_wake( state, framer, gps_fd, power_fd, started );
+                } else if (fd == gps_fd)
+                {
+                    state->read_stats.wakeups += 1;
+                    if (gps_state_read( state, framer, fd ) > 0 &&
+                        state->read_mode == GPS_READ_BATCH)
                     {
-			            if (errno == EINTR)
-                        {
-   				            continue;
-                                        }
-			            } 
-//D("received %d bytes: %s", ret, buf);
-                        if (ret > 0)
-			            {
-                            for (nn = 0; nn < ret; nn++)
-                            {
-                                nmea_reader_addc( reader, buf[nn] );
-							}
-                            
-						}
-                       
-////////////////////////
-#if 0
-	               if (state->reader.fix.flags !=0 && !first_fix_location)
-					{
-						char *p;
-						int fd;
-						DFR("first fixing =============================================================\n");
-						first_fix_location = 1;
-						t1 = get_time_now();
-						time_div = t1.tv_sec * 1000 + t1.tv_usec / 1000 -(t0.tv_sec * 1000 + t0.tv_usec / 1000 );
-						fd = open("/data/starting_time",O_WRONLY|O_CREAT|O_APPEND);
-					//	if (fd == -1) goto xxx;
-						DFR("first fixing div_time is %f ms\n", time_div);
-						DFR("first fixing div_time is %f ms\n", time_div);
-						DFR("first fixing div_time is %f ms\n", time_div);
-						DFR("first fixing div_time is %d ms\n", time_div);
-						asprintf(&p, "time = %d\n", time_div);
-						write(fd, p, strlen(p)+1); 
-						xxx:
-						close(fd);
-					}
-					////////////////////////
-#endif
+                        timeout = GPS_READ_IDLE_MS;
+                    }
+                    gps_duty_update( state, timer_fd, power_fd, started );
 
 
                      // D("gps fd event end");
@@ -1013,55 +1180,21 @@ static void* gps_state_thread( void*  arg )
         }
     }
 Exit:
-	gps_power_off();
-	if(fd_gpslog != -1)
-	close(fd_gpslog);
-	fd_gpslog = -1;
+	close(timer_fd);
+	close(power_fd);
+	close(epoll_fd);
+	if (!state->duty.off)
+	{
+		gps_dev_deinit( &state->dev );
+		gps_power_off();
+	}
+	gps_state_note_baud( state );
+	gps_state_save_cache( state, 1 );
+	gps_cache_done( &state->cache );
       return NULL;
 }
 
-static void* gps_timer_thread( void*  arg )
-{
-    D("gps_time_thread IN");
-    GpsState *state = (GpsState *)arg;
-    DFR("gps entered timer thread");
-    do {
-        D ("gps timer exp");
-        GPS_STATE_LOCK_FIX(state);
-		if (state->reader.fix.flags != 0)
-       	{
-            D("gps fix cb: 0x%x", state->reader.fix.flags);
-          	if (state->callbacks.location_cb) 
-           	{
-	     	    state->callbacks.location_cb( &state->reader.fix );
-	            state->reader.fix.flags = 0;
-	            state->first_fix = 1;
-	        }
-	        if (state->fix_freq == 0) 
-            {
-	            state->fix_freq = -1;
-	        }
-         }
-
-    	if (state->reader.sv_status_changed != 0) 
-        {
-            D("gps sv status callback");
-            if (state->callbacks.sv_status_cb) 
-            {
-	            state->callbacks.sv_status_cb( &state->reader.sv_status );
-	            state->reader.sv_status_changed = 0;
-	        }
-        }
-        GPS_STATE_UNLOCK_FIX(state);
-	    sleep(state->fix_freq);
-    } while(state->init == STATE_START);
-	
-	DFR("gps timer thread destroyed");
-    D("gps_time_thread out");
-    return NULL;
-}
-
-int gps_open(void)
+int gps_open(int read_mode)
 {
     D("gps_open IN");
     struct termios tio;
@@ -1076,8 +1209,18 @@ int gps_open(void)
     tio.c_cflag = CLOCAL | CREAD | CS8 | HUPCL | CRTSCTS;
     tio.c_oflag = 0;
     tio.c_lflag = 0;
-    tio.c_cc[VMIN] = 1;
-    tio.c_cc[VTIME] = 10;
+    if (read_mode == GPS_READ_BATCH)
+    {
+        /* poll() only reports the tty readable once VMIN bytes are there,
+         * as long as VTIME is 0
+         */
+        tio.c_cc[VMIN] = GPS_READ_VMIN;
+        tio.c_cc[VTIME] = 0;
+    } else
+    {
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 10;
+    }
     cfsetispeed(&tio, speed);
     cfsetospeed(&tio, speed);
     tcsetattr(tty_fd, TCSANOW, &tio);
@@ -1085,6 +1228,29 @@ int gps_open(void)
     D("gps_open out");
     return tty_fd;
 }
+static int gps_read_mode(void)
+{
+    char  prop[PROPERTY_VALUE_MAX];
+
+    property_get("gps.read.mode", prop, "batch");
+    if (!strcmp(prop, "legacy"))
+        return GPS_READ_LEGACY;
+    if (!strcmp(prop, "drain"))
+        return GPS_READ_DRAIN;
+    return GPS_READ_BATCH;
+}
+
+/* "nmea" or "sirf", read when the HAL is initialized */
+static int gps_protocol(void)
+{
+    char  prop[PROPERTY_VALUE_MAX];
+
+    property_get("gps.protocol", prop, "nmea");
+    if (!strcmp(prop, "sirf"))
+        return GPS_DEV_SIRF;
+    return GPS_DEV_NMEA;
+}
+
 static void gps_state_init( GpsState*  state )
 {
     D("gps_state_init In");
@@ -1097,15 +1263,12 @@ static void gps_state_init( GpsState*  state )
     state->control[0] = -1;
     state->control[1] = -1;
     state->fd         = -1;
-    state->fix_freq   = -1;
+    state->fix_interval = -1;
     state->first_fix  = 0;
-    if (sem_init(&state->fix_sem, 0, 1) != 0) 
-    {
-        D("gps semaphore initialization failed! errno ");
-        D("gps_state_init out");
-        return;
-    }
-    state->fd = gps_open();
+    state->read_mode  = gps_read_mode();
+    state->protocol   = gps_protocol();
+    pthread_mutex_init( &state->aiding_lock, NULL );
+    state->fd = gps_open(state->read_mode);
   //look for a kernel-provided device name
   // if (property_get("ro.kernel.android.gps",prop,"") == 0) {
   //    D("no kernel-provided gps device name");
@@ -1136,6 +1299,15 @@ static void gps_state_init( GpsState*  state )
         LOGE("could not create thread control socket pair: %s", strerror(errno));
         goto Fail;
     }
+    if ( gps_dispatch_init( &state->dispatch, &state->callbacks ) < 0 )
+    {
+        goto Fail;
+    }
+    state->dispatch.metrics = &gps_metrics;
+    state->dispatch.sv_ext_callbacks = &state->sv_ext_callbacks;
+    state->dispatch.sv_delta_callbacks = &state->sv_delta_callbacks;
+    /* logging is optional, carry on without it */
+    gps_logger_init( &state->logger, "sys.gps.log", "/sdcard" );
     if ( pthread_create( &state->thread, NULL, gps_state_thread, state ) != 0 ) 
     {
         LOGE("could not create gps thread: %s", strerror(errno));
@@ -1168,6 +1340,7 @@ static int vimm_gps_init(GpsCallbacks* callbacks)
         return -1;
     }
     s->callbacks = *callbacks;
+    gps_state_update_callbacks(s);
     D("vimm_gps_init out");
     return 0;
 }
@@ -1224,13 +1397,32 @@ static void vimm_gps_set_fix_frequency(int freq)
     	return;
   	}
   	D("%s: called", __FUNCTION__);
-  	s->fix_freq = (freq <= 0) ? 1 : freq;
+  	gps_state_update_fix_interval(s, (freq <= 0) ? 1000 : freq * 1000);
   	D("gps fix frquency set to %d secs", freq);
   	D("vimm_gps_set_fix_frequency out");
 }
 
+/* timeReference is on the framework's elapsedRealtime clock, which isn't
+ * readable from here. the call comes right after the NTP exchange, so the
+ * time is taken as current and the round trip is in the uncertainty.
+ */
 static int vimm_gps_inject_time(GpsUtcTime time, int64_t timeReference, int uncertainty)
 {
+    GpsState*  s = _gps_state;
+
+    if (!s->init)
+        return -1;
+    if (uncertainty > GPS_AID_MAX_TIME_UNCERTAINTY)
+    {
+        D("ignoring injected time, uncertainty %d ms", uncertainty);
+        return 0;
+    }
+    pthread_mutex_lock( &s->aiding_lock );
+    s->aiding.time       = time;
+    s->aiding.time_ref   = gps_monotonic_ms();
+    s->aiding.time_valid = 1;
+    pthread_mutex_unlock( &s->aiding_lock );
+    gps_state_update_aiding(s);
     return 0;
 }
 
@@ -1251,7 +1443,8 @@ static int vimm_gps_set_position_mode(GpsPositionMode mode, int fix_frequency)
         D("%s: called with uninitialized state !!", __FUNCTION__);
         return -1;
     }
-    s->fix_freq = fix_frequency;
+    /* the HAL gives seconds, the fix timer works in ms */
+    gps_state_update_fix_interval(s, fix_frequency * 1000);
     D("gps fix frquency set to %d secs", fix_frequency);
     D("vimm_gps_set_position_mode out");
     return 0;
@@ -1261,13 +1454,110 @@ static int vimm_gps_set_position_mode(GpsPositionMode mode, int fix_frequency)
 /* guanxiaowei 20100817 begin: add this function to inject location  */
 static int vimm_gps_inject_location(double latitude, double longitude, float accuracy)
 {
+    GpsState*  s = _gps_state;
+
+    if (!s->init)
+        return -1;
+    if (accuracy <= 0 || accuracy > GPS_AID_MAX_ACCURACY)
+    {
+        D("ignoring injected location, accuracy %.0f m", accuracy);
+        return 0;
+    }
+    pthread_mutex_lock( &s->aiding_lock );
+    s->aiding.latitude       = latitude;
+    s->aiding.longitude      = longitude;
+    s->aiding.altitude       = 0;       /* whatever was known may be elsewhere */
+    s->aiding.location_valid = 1;
+    pthread_mutex_unlock( &s->aiding_lock );
+    gps_state_update_aiding(s);
     return 0;
 }
 /* guanxiaowei 20100817 begin: add this function to inject location */
 
+/* the metrics, then the counters of the running session if there is one */
+static int vimm_gps_debug_dump(char* buf, int len)
+{
+    GpsState*  s = _gps_state;
+    int        pos, ret;
+
+    pos = gps_metrics_dump( &gps_metrics, buf, len );
+    if (!s->init)
+        return pos;
+
+    ret = snprintf( pos < len ? buf + pos : NULL, pos < len ? len - pos : 0,
+                    "reads: %u wakeups (%u idle), %u reads, %u bytes\n"
+                    "dispatch: %u events, %u delivered, %u coalesced, %u dropped\n"
+                    "nmea: %u sentences, %u malformed, %u bad checksum\n"
+                    "sv: %u reports, %u unchanged\n"
+                    "duty: %u power-offs, reacquisition %d ms%s\n",
+                    s->read_stats.wakeups, s->read_stats.idle_reads,
+                    s->read_stats.reads, s->read_stats.bytes,
+                    s->dispatch.stats.posted, s->dispatch.stats.delivered,
+                    s->dispatch.stats.coalesced, s->dispatch.stats.dropped,
+                    s->reader.stats.sentences, s->reader.stats.malformed,
+                    s->reader.stats.bad_checksum,
+                    s->sv_reports, s->sv_unchanged,
+                    s->duty.sleeps, s->duty.reacq,
+                    s->duty.fallback ? ", continuous" : "" );
+    return (ret < 0) ? pos : pos + ret;
+}
+
+static void vimm_gps_debug_reset(void)
+{
+    gps_metrics_reset( &gps_metrics );
+}
+
+static const GpsDebugInterface  vimmGpsDebugInterface = {
+    vimm_gps_debug_dump,
+    vimm_gps_debug_reset,
+};
+
+/* the callback may be set before or after init, the gps thread is told
+ * so that the receiver outputs GSV for it
+ */
+static int vimm_gps_sv_ext_init(GpsSvExtCallbacks* callbacks)
+{
+    GpsState*  s = _gps_state;
+
+    if (callbacks)
+        s->sv_ext_callbacks = *callbacks;
+    else
+        memset( &s->sv_ext_callbacks, 0, sizeof(s->sv_ext_callbacks) );
+    if (s->init)
+        gps_state_update_callbacks(s);
+    return 0;
+}
+
+static const GpsSvExtInterface  vimmGpsSvExtInterface = {
+    vimm_gps_sv_ext_init,
+};
+
+static int vimm_gps_sv_delta_init(GpsSvDeltaCallbacks* callbacks)
+{
+    GpsState*  s = _gps_state;
+
+    if (callbacks)
+        s->sv_delta_callbacks = *callbacks;
+    else
+        memset( &s->sv_delta_callbacks, 0, sizeof(s->sv_delta_callbacks) );
+    if (s->init)
+        gps_state_update_callbacks(s);
+    return 0;
+}
+
+static const GpsSvDeltaInterface  vimmGpsSvDeltaInterface = {
+    vimm_gps_sv_delta_init,
+};
+
 static const void*
 vimm_gps_get_extension(const char* name)
 {
+    if (!strcmp(name, GPS_DEBUG_INTERFACE))
+        return &vimmGpsDebugInterface;
+    if (!strcmp(name, GPS_SV_EXT_INTERFACE))
+        return &vimmGpsSvExtInterface;
+    if (!strcmp(name, GPS_SV_DELTA_INTERFACE))
+        return &vimmGpsSvDeltaInterface;
     return NULL;
 }
 
@@ -1328,11 +1618,3 @@ static int gps_power_off(void)
     D("gps_power_off out");
     return 0;
 }
-
-static struct timeval get_time_now(void)
-{
-    struct timeval t;
-    gettimeofday(&t,0);
-    return t;
-}
-
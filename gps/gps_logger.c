@@ -0,0 +1,348 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_logger"
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "gps_logger.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+/* a partial block is written anyway once it has waited this long */
+#define  GPS_LOGGER_FLUSH_MS  10000
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       L O G   F I L E S                               *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static int
+gps_logger_open( GpsLogger*  l, const char*  ext )
+{
+    char        path[256];
+    time_t      now = time(NULL);
+    struct tm   tm;
+    int         fd;
+
+    localtime_r( &now, &tm );
+    snprintf( path, sizeof(path), "%s/%4.4d-%2.2d-%2.2d-%2.2d%2.2d%2.2d.%s",
+              l->dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+              tm.tm_hour, tm.tm_min, tm.tm_sec, ext );
+
+    fd = open( path, O_WRONLY|O_CREAT|O_APPEND, 0644 );
+    if (fd < 0) {
+        LOGE("could not open log file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    l->stats.files += 1;
+    D("logging to %s", path);
+    return fd;
+}
+
+
+static void
+gps_logger_text_output( GpsLogger*  l, const char*  p, int  len )
+{
+    while (len > 0) {
+        int  ret;
+
+        if (l->fd < 0) {
+            l->fd = gps_logger_open( l, "log" );
+            if (l->fd < 0)
+                return;
+            l->file_size = lseek( l->fd, 0, SEEK_END );
+        }
+
+        do {
+            ret = write( l->fd, p, len );
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret <= 0) {
+            LOGE("could not write log file: %s", strerror(errno));
+            close( l->fd );
+            l->fd = -1;
+            return;
+        }
+        l->stats.writes += 1;
+        l->stats.bytes  += ret;
+        l->file_size    += ret;
+        p   += ret;
+        len -= ret;
+
+        if (l->file_size >= GPS_LOGGER_MAX_FILE_SIZE) {
+            close( l->fd );
+            l->fd = -1;
+        }
+    }
+}
+
+
+/* write the whole blocks of text, or everything if 'all' is set */
+static void
+gps_logger_text_flush( GpsLogger*  l, int  all )
+{
+    int  len = l->text_len;
+
+    if (!all)
+        len -= len % GPS_LOGGER_BLOCK_SIZE;
+    if (len == 0)
+        return;
+
+    gps_logger_text_output( l, l->text, len );
+    memmove( l->text, l->text + len, l->text_len - len );
+    l->text_len -= len;
+}
+
+
+static void
+gps_logger_close( GpsLogger*  l )
+{
+    gps_logger_text_flush( l, 1 );
+    if (l->fd >= 0) {
+        close( l->fd );
+        l->fd = -1;
+    }
+    if (l->capture != NULL) {
+        l->stats.bytes += l->capture->offset;
+        gps_capture_writer_free( l->capture );
+        l->capture = NULL;
+    }
+}
+
+
+static void
+gps_logger_output( GpsLogger*  l, int  mode, uint64_t  time_us, const char*  p, int  len )
+{
+    if (mode != l->out_mode) {
+        gps_logger_close( l );
+        l->out_mode = mode;
+    }
+
+    if (mode == GPS_LOGGER_TEXT) {
+        if (l->text_len + len > (int)sizeof(l->text))
+            gps_logger_text_flush( l, 0 );
+        memcpy( l->text + l->text_len, p, len );
+        l->text_len += len;
+    }
+    else if (mode == GPS_LOGGER_CAPTURE) {
+        if (l->capture == NULL) {
+            int  fd = gps_logger_open( l, "gpscap" );
+            if (fd < 0)
+                return;
+            l->capture = gps_capture_writer_new( fd );
+            if (l->capture == NULL)
+                return;
+        }
+        if (gps_capture_writer_add( l->capture, time_us, p, len ) < 0 ||
+            l->capture->offset >= GPS_LOGGER_MAX_FILE_SIZE) {
+            l->stats.bytes += l->capture->offset;
+            gps_capture_writer_free( l->capture );
+            l->capture = NULL;
+        }
+    }
+}
+
+
+static void
+gps_logger_flush( GpsLogger*  l )
+{
+    gps_logger_text_flush( l, 1 );
+    if (l->capture != NULL)
+        gps_capture_writer_flush( l->capture );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       W R I T E R   T H R E A D                       *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* records in the buffers: a time stamp and a length, then the data */
+typedef struct {
+    uint64_t  time_us;
+    int32_t   len;
+} GpsLogRecord;
+
+
+static int
+gps_logger_poll_property( GpsLogger*  l )
+{
+    char  value[PROPERTY_VALUE_MAX];
+
+    if (property_get( l->property, value, NULL ) <= 0)
+        return GPS_LOGGER_OFF;
+    if (!strncmp( value, "on", 2 ))
+        return GPS_LOGGER_TEXT;
+    if (!strcmp( value, "capture" ))
+        return GPS_LOGGER_CAPTURE;
+    return GPS_LOGGER_OFF;
+}
+
+
+static void*
+gps_logger_thread( void*  arg )
+{
+    GpsLogger*  l = arg;
+    long long   waiting = 0;    /* how long output has been held back */
+
+    pthread_mutex_lock( &l->lock );
+    for (;;) {
+        struct timeval   tv;
+        struct timespec  ts;
+        int              mode, pos;
+
+        gettimeofday( &tv, NULL );
+        ts.tv_sec  = tv.tv_sec + GPS_LOGGER_POLL_MS / 1000;
+        ts.tv_nsec = tv.tv_usec * 1000 + (GPS_LOGGER_POLL_MS % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        if (!l->quit && l->fill_len < GPS_LOGGER_BUFFER_SIZE/2) {
+            if (pthread_cond_timedwait( &l->cond, &l->lock, &ts ) == ETIMEDOUT)
+                waiting += GPS_LOGGER_POLL_MS;
+        }
+
+        /* the property is only read here, not for every chunk */
+        pthread_mutex_unlock( &l->lock );
+        mode = gps_logger_poll_property( l );
+        pthread_mutex_lock( &l->lock );
+
+        if (mode != l->mode)
+            LOGD("gps logging mode %d", mode);
+        l->mode = mode;
+
+        /* swapping the buffers is all the GPS thread ever waits for */
+        {
+            char*  tmp = l->drain;
+            l->drain     = l->fill;
+            l->drain_len = l->fill_len;
+            l->fill      = tmp;
+            l->fill_len  = 0;
+        }
+        pthread_mutex_unlock( &l->lock );
+
+        for (pos = 0; pos + (int)sizeof(GpsLogRecord) <= l->drain_len; ) {
+            GpsLogRecord  rec;
+
+            memcpy( &rec, l->drain + pos, sizeof(rec) );
+            pos += sizeof(rec);
+            if (mode != GPS_LOGGER_OFF)
+                gps_logger_output( l, mode, rec.time_us, l->drain + pos, rec.len );
+            pos += rec.len;
+        }
+        l->drain_len = 0;
+
+        if (mode != l->out_mode || l->quit) {
+            gps_logger_close( l );
+            l->out_mode = mode;
+        } else if (waiting >= GPS_LOGGER_FLUSH_MS) {
+            gps_logger_flush( l );
+            waiting = 0;
+        } else
+            gps_logger_text_flush( l, 0 );
+
+        pthread_mutex_lock( &l->lock );
+        if (l->quit)
+            break;
+    }
+    pthread_mutex_unlock( &l->lock );
+    return NULL;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       L O G G E R                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+int
+gps_logger_init( GpsLogger*  l, const char*  property, const char*  dir )
+{
+    memset( l, 0, sizeof(*l) );
+    l->property = property;
+    l->dir      = dir;
+    l->fd       = -1;
+    l->fill     = l->buffers[0];
+    l->drain    = l->buffers[1];
+    l->mode     = gps_logger_poll_property( l );
+
+    pthread_mutex_init( &l->lock, NULL );
+    pthread_cond_init( &l->cond, NULL );
+    if (pthread_create( &l->thread, NULL, gps_logger_thread, l ) != 0) {
+        LOGE("could not create logger thread: %s", strerror(errno));
+        pthread_cond_destroy( &l->cond );
+        pthread_mutex_destroy( &l->lock );
+        l->mode = GPS_LOGGER_OFF;
+        l->dir  = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+void
+gps_logger_done( GpsLogger*  l )
+{
+    void*  dummy;
+
+    if (l->dir == NULL)
+        return;
+
+    pthread_mutex_lock( &l->lock );
+    l->quit = 1;
+    pthread_cond_signal( &l->cond );
+    pthread_mutex_unlock( &l->lock );
+    pthread_join( l->thread, &dummy );
+
+    pthread_cond_destroy( &l->cond );
+    pthread_mutex_destroy( &l->lock );
+    l->dir = NULL;
+
+    if (l->stats.bytes > 0 || l->stats.dropped > 0)
+        LOGD("logger: %u bytes in %u writes to %u files, %u bytes dropped",
+             l->stats.bytes, l->stats.writes, l->stats.files, l->stats.dropped);
+}
+
+
+void
+gps_logger_write( GpsLogger*  l, uint64_t  time_us, const char*  p, int  len )
+{
+    GpsLogRecord  rec;
+
+    if (l->mode == GPS_LOGGER_OFF)
+        return;
+
+    rec.time_us = time_us;
+    rec.len     = len;
+
+    pthread_mutex_lock( &l->lock );
+    if (l->fill_len + (int)sizeof(rec) + len > GPS_LOGGER_BUFFER_SIZE) {
+        l->stats.dropped += len;
+    } else {
+        memcpy( l->fill + l->fill_len, &rec, sizeof(rec) );
+        memcpy( l->fill + l->fill_len + sizeof(rec), p, len );
+        l->fill_len += sizeof(rec) + len;
+        if (l->fill_len >= GPS_LOGGER_BUFFER_SIZE/2)
+            pthread_cond_signal( &l->cond );
+    }
+    pthread_mutex_unlock( &l->lock );
+}
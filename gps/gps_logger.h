@@ -0,0 +1,75 @@
+#ifndef _gps_logger_h
+#define _gps_logger_h
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "gps_capture.h"
+
+/* size of each of the two log buffers */
+#define  GPS_LOGGER_BUFFER_SIZE   (32*1024)
+
+/* text logs are written to the file in multiples of this */
+#define  GPS_LOGGER_BLOCK_SIZE    4096
+
+/* a new file is started when the current one grows past this */
+#define  GPS_LOGGER_MAX_FILE_SIZE (4*1024*1024)
+
+/* how often the writer thread looks at the property and flushes */
+#define  GPS_LOGGER_POLL_MS       1000
+
+/* what is written, from the value of the property */
+enum {
+    GPS_LOGGER_OFF     = 0,
+    GPS_LOGGER_TEXT    = 1,     /* "on": the raw NMEA stream, as before */
+    GPS_LOGGER_CAPTURE = 2,     /* "capture": timed chunks, see gps_capture.h */
+};
+
+typedef struct {
+    unsigned  bytes;            /* bytes written to files */
+    unsigned  writes;           /* write() calls */
+    unsigned  dropped;          /* bytes lost because the buffer was full */
+    unsigned  files;            /* files opened */
+} GpsLoggerStats;
+
+/* logs the receiver's output to files, depending on the 'property' system
+ * property. the GPS thread only appends to a memory buffer, the property is
+ * polled and the files are written by a background thread.
+ */
+typedef struct {
+    const char*        property;
+    const char*        dir;
+    volatile int       mode;        /* cached value of the property */
+    int                quit;
+    pthread_t          thread;
+    pthread_mutex_t    lock;
+    pthread_cond_t     cond;
+    char*              fill;        /* records appended by the GPS thread */
+    int                fill_len;
+    char*              drain;       /* records owned by the writer thread */
+    int                drain_len;
+    int                out_mode;    /* mode of the current file */
+    int                fd;          /* text log */
+    off_t              file_size;
+    GpsCaptureWriter*  capture;     /* capture file */
+    int                text_len;    /* text waiting for a whole block */
+    GpsLoggerStats     stats;
+    char               buffers[2][ GPS_LOGGER_BUFFER_SIZE ];
+    char               text[ GPS_LOGGER_BUFFER_SIZE + GPS_LOGGER_BLOCK_SIZE ];
+} GpsLogger;
+
+extern int
+gps_logger_init( GpsLogger*  l, const char*  property, const char*  dir );
+
+/* flushes what is buffered and stops the writer thread */
+extern void
+gps_logger_done( GpsLogger*  l );
+
+/* record a chunk read from the receiver at 'time_us', on CLOCK_MONOTONIC.
+ * never blocks on I/O, data that doesn't fit in the buffer is dropped.
+ */
+extern void
+gps_logger_write( GpsLogger*  l, uint64_t  time_us, const char*  p, int  len );
+
+#endif /* _gps_logger_h */
@@ -0,0 +1,146 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "gps_metrics.h"
+
+uint64_t
+gps_metrics_now( void )
+{
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void
+gps_histogram_add( GpsHistogram*  h, uint64_t  us )
+{
+    uint32_t  v = (us > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t) us;
+    int       b = (v == 0) ? 0 : 32 - __builtin_clz(v);
+
+    if (b >= GPS_HISTOGRAM_BUCKETS)
+        b = GPS_HISTOGRAM_BUCKETS - 1;
+
+    if (h->reset && __sync_lock_test_and_set( &h->reset, 0 )) {
+        memset( h->buckets, 0, sizeof(h->buckets) );
+        h->sum   = 0;
+        h->max   = 0;
+        h->count = 0;
+    }
+
+    h->buckets[b] += 1;
+    h->sum        += us;
+    if (v > h->max)
+        h->max = v;
+    h->count += 1;
+}
+
+
+void
+gps_metrics_reset( GpsMetrics*  m )
+{
+    __sync_lock_test_and_set( &m->ttff.reset,        1 );
+    __sync_lock_test_and_set( &m->fix_latency.reset, 1 );
+    __sync_lock_test_and_set( &m->parse.reset,       1 );
+    __sync_lock_test_and_set( &m->callback.reset,    1 );
+}
+
+
+uint64_t
+gps_histogram_percentile( const GpsHistogram*  h, int  percent )
+{
+    uint64_t  want, seen = 0;
+    int       b;
+
+    if (h->count == 0)
+        return 0;
+
+    /* the rank of the sample, rounded up so that p100 is the last one */
+    want = ((uint64_t)h->count * percent + 99) / 100;
+    for (b = 0; b < GPS_HISTOGRAM_BUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen >= want)
+            return 1ull << b;
+    }
+    return h->max;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E P O R T                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* snprintf() that keeps counting once the buffer is full */
+static int
+gps_metrics_printf( char*  buf, int  len, int  pos, const char*  fmt, ... )
+    __attribute__((format(printf, 4, 5)));
+
+static int
+gps_metrics_printf( char*  buf, int  len, int  pos, const char*  fmt, ... )
+{
+    va_list  args;
+    int      ret;
+
+    va_start( args, fmt );
+    if (pos < len)
+        ret = vsnprintf( buf + pos, len - pos, fmt, args );
+    else
+        ret = vsnprintf( NULL, 0, fmt, args );
+    va_end( args );
+    return (ret < 0) ? pos : pos + ret;
+}
+
+
+static int
+gps_histogram_dump( const GpsHistogram*  h, const char*  name,
+                    char*  buf, int  len, int  pos )
+{
+    static const GpsHistogram  empty;
+    int                        b;
+
+    /* cleared, but its writer hasn't noticed yet */
+    if (h->reset)
+        h = &empty;
+
+    pos = gps_metrics_printf( buf, len, pos,
+            "%s: count %u mean %llu max %u p50 %llu p90 %llu p99 %llu (us)\n",
+            name, h->count,
+            h->count ? (unsigned long long)(h->sum / h->count) : 0ull, h->max,
+            (unsigned long long) gps_histogram_percentile(h, 50),
+            (unsigned long long) gps_histogram_percentile(h, 90),
+            (unsigned long long) gps_histogram_percentile(h, 99) );
+
+    for (b = 0; b < GPS_HISTOGRAM_BUCKETS; b++) {
+        if (h->buckets[b] == 0)
+            continue;
+        if (b == GPS_HISTOGRAM_BUCKETS - 1)
+            pos = gps_metrics_printf( buf, len, pos, "  >= %llu: %u\n",
+                                      1ull << (b - 1), h->buckets[b] );
+        else
+            pos = gps_metrics_printf( buf, len, pos, "  < %llu: %u\n",
+                                      1ull << b, h->buckets[b] );
+    }
+    return pos;
+}
+
+
+int
+gps_metrics_dump( const GpsMetrics*  m, char*  buf, int  len )
+{
+    int  pos = 0;
+
+    if (len > 0)
+        buf[0] = 0;
+
+    pos = gps_histogram_dump( &m->ttff,        "ttff",        buf, len, pos );
+    pos = gps_histogram_dump( &m->fix_latency, "fix_latency", buf, len, pos );
+    pos = gps_histogram_dump( &m->parse,       "parse",       buf, len, pos );
+    pos = gps_histogram_dump( &m->callback,    "callback",    buf, len, pos );
+    return pos;
+}
@@ -0,0 +1,57 @@
+#ifndef _gps_metrics_h
+#define _gps_metrics_h
+
+#include <stdint.h>
+
+/* durations are kept in log2 histograms of microseconds: bucket 0 counts
+ * values under 1 us, bucket i values in [2^(i-1), 2^i), the last one
+ * everything from 2^(GPS_HISTOGRAM_BUCKETS-2) us, about 17 minutes, up.
+ * adding a value is a few instructions and never allocates.
+ */
+#define  GPS_HISTOGRAM_BUCKETS  32
+
+/* each histogram has a single writer. readers may see a count that is off
+ * by one sample, which doesn't matter here. other threads never clear a
+ * histogram themselves, they raise 'reset' and the writer does it.
+ */
+typedef struct {
+    uint32_t      count;
+    uint32_t      max;
+    uint64_t      sum;
+    uint32_t      buckets[ GPS_HISTOGRAM_BUCKETS ];
+    volatile int  reset;
+} GpsHistogram;
+
+typedef struct {
+    GpsHistogram  ttff;         /* session start to the first fix with a position */
+    GpsHistogram  fix_latency;  /* epoch's first read() to location_cb returning */
+    GpsHistogram  parse;        /* time spent parsing each epoch */
+    GpsHistogram  callback;     /* time spent in each framework callback */
+} GpsMetrics;
+
+/* CLOCK_MONOTONIC, in us */
+extern uint64_t
+gps_metrics_now( void );
+
+extern void
+gps_histogram_add( GpsHistogram*  h, uint64_t  us );
+
+/* ask the writers to clear all histograms. safe from any thread: each one
+ * is cleared on its next sample and reports as empty until then.
+ */
+extern void
+gps_metrics_reset( GpsMetrics*  m );
+
+/* the value below which 'percent' of the samples are, rounded up to a
+ * bucket boundary. 0 if there are no samples.
+ */
+extern uint64_t
+gps_histogram_percentile( const GpsHistogram*  h, int  percent );
+
+/* write a text report of all histograms to 'buf', which is always
+ * terminated. returns the length of the text, as snprintf() would.
+ */
+extern int
+gps_metrics_dump( const GpsMetrics*  m, char*  buf, int  len );
+
+#endif /* _gps_metrics_h */
@@ -0,0 +1,709 @@
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define  LOG_TAG  "gps_replay"
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <hardware_legacy/gps.h>
+#include <hardware_legacy/gps_sv_ext.h>
+
+#include "gps_capture.h"
+#include "gps_dispatch.h"
+#include "gps_sv_delta.h"
+#include "nmea_framer.h"
+#include "nmea_parser.h"
+
+/* the file to replay, a capture written by the GPS logger or plain NMEA */
+#define  REPLAY_FILE_PROPERTY   "gps.replay.file"
+
+/* "1" for real time (the default), "N" for N times real time, "0" or
+ * "max" for as fast as possible
+ */
+#define  REPLAY_SPEED_PROPERTY  "gps.replay.speed"
+
+/* when replaying as fast as possible, control commands are checked
+ * after this many chunks
+ */
+#define  REPLAY_BURST  64
+
+/* NMEA text has no reception times, epochs are spaced by their time tags
+ * when these look sane and by this otherwise
+ */
+#define  REPLAY_DEFAULT_EPOCH_MS  1000
+#define  REPLAY_MAX_EPOCH_MS      10000
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static double
+replay_now_ms( void )
+{
+    struct timespec  ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000. + ts.tv_nsec / 1e6;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E P L A Y   S O U R C E                       *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* where the chunks come from, and when each of them is due */
+typedef struct {
+    GpsCaptureReader*  capture;     /* NULL for NMEA text */
+    int                fd;          /* NMEA text */
+    double             speed;       /* 0 for as fast as possible */
+    double             due;         /* when the pending chunk is due, in ms */
+    const char*        pending;     /* next chunk to feed, NULL at the end */
+    int                pending_len;
+    uint64_t           last_time;   /* capture time of the previous chunk */
+    int                have_time;
+    int                epoch_tod;   /* time tag of the last epoch, NMEA text */
+    double             epoch_delay; /* wait before the next line, NMEA text */
+    int                paced;       /* epoch_delay applied to the pending line */
+    int                text_len;
+    int                text_pos;
+    char               text[ 4096 ];
+} ReplaySource;
+
+
+static int
+replay_source_open( ReplaySource*  src, const char*  path, double  speed )
+{
+    char  magic[8];
+    int   fd;
+
+    memset( src, 0, sizeof(*src) );
+    src->fd        = -1;
+    src->speed     = speed;
+    src->epoch_tod = -1;
+
+    fd = open( path, O_RDONLY );
+    if (fd < 0) {
+        LOGE("could not open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (read( fd, magic, sizeof(magic) ) == sizeof(magic) &&
+        !memcmp( magic, GPS_CAPTURE_MAGIC, sizeof(magic) )) {
+        close( fd );
+        src->capture = gps_capture_reader_open( path );
+        if (src->capture == NULL)
+            return -1;
+        LOGD("replaying capture %s", path);
+    } else {
+        lseek( fd, 0, SEEK_SET );
+        src->fd = fd;
+        LOGD("replaying NMEA text %s", path);
+    }
+    return 0;
+}
+
+
+static void
+replay_source_close( ReplaySource*  src )
+{
+    gps_capture_reader_close( src->capture );
+    src->capture = NULL;
+    if (src->fd >= 0) {
+        close( src->fd );
+        src->fd = -1;
+    }
+}
+
+
+/* the next line of an NMEA text file */
+static int
+replay_source_next_line( ReplaySource*  src, const char**  p, int*  len )
+{
+    for (;;) {
+        char*  start = src->text + src->text_pos;
+        char*  nl    = memchr( start, '\n', src->text_len - src->text_pos );
+        int    ret;
+
+        if (nl != NULL) {
+            *p  = start;
+            *len = nl + 1 - start;
+            src->text_pos += *len;
+            return 1;
+        }
+
+        /* keep the partial line and read more */
+        memmove( src->text, start, src->text_len - src->text_pos );
+        src->text_len -= src->text_pos;
+        src->text_pos  = 0;
+
+        if (src->text_len == (int)sizeof(src->text)) {
+            /* no newline in sight, hand it to the framer which drops it */
+            *p  = src->text;
+            *len = src->text_len;
+            src->text_pos = src->text_len;
+            return 1;
+        }
+
+        do {
+            ret = read( src->fd, src->text + src->text_len,
+                        sizeof(src->text) - src->text_len );
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret <= 0) {
+            if (src->text_len == 0)
+                return 0;
+            /* last line without a terminator */
+            *p  = src->text;
+            *len = src->text_len;
+            src->text_pos = src->text_len;
+            return 1;
+        }
+        src->text_len += ret;
+    }
+}
+
+
+/* read the next chunk and work out when it is due */
+static void
+replay_source_fetch( ReplaySource*  src )
+{
+    double  delay = 0;
+
+    src->pending = NULL;
+
+    if (src->capture != NULL) {
+        uint64_t  time_us;
+
+        if (gps_capture_reader_next( src->capture, &time_us,
+                                     &src->pending, &src->pending_len ) != 1) {
+            src->pending = NULL;
+            return;
+        }
+        if (src->have_time && time_us > src->last_time)
+            delay = (time_us - src->last_time) / 1000.;
+        src->last_time = time_us;
+        src->have_time = 1;
+    } else {
+        if (replay_source_next_line( src, &src->pending, &src->pending_len ) != 1) {
+            src->pending = NULL;
+            return;
+        }
+        delay = src->epoch_delay;
+        src->epoch_delay = 0;
+        src->paced       = 0;
+    }
+
+    if (src->speed > 0)
+        src->due += delay / src->speed;
+}
+
+
+/* called when an epoch of an NMEA text file tagged 'tod' ends, the line
+ * that starts the next one waits for the time between the two.
+ */
+static void
+replay_source_epoch( ReplaySource*  src, int  tod )
+{
+    if (src->capture != NULL)
+        return;
+
+    src->epoch_delay = REPLAY_DEFAULT_EPOCH_MS;
+    if (src->epoch_tod >= 0 && tod >= 0) {
+        int  delta = tod - src->epoch_tod;
+        if (delta < 0)
+            delta += 24*3600*1000;
+
+        if (delta > 0 && delta <= REPLAY_MAX_EPOCH_MS)
+            src->epoch_delay = delta;
+    }
+    src->epoch_tod = tod;
+}
+
+
+/* start over once the whole file was played. returns -1 on error */
+static int
+replay_source_rewind( ReplaySource*  src )
+{
+    if (src->capture != NULL) {
+        src->have_time = 0;
+        return gps_capture_reader_seek( src->capture, 0 ) < 0 ? -1 : 0;
+    }
+
+    src->text_len    = 0;
+    src->text_pos    = 0;
+    src->epoch_tod   = -1;
+    src->epoch_delay = 0;
+    return lseek( src->fd, 0, SEEK_SET ) < 0 ? -1 : 0;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E P L A Y   S T A T E                         *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* commands sent to the replay thread */
+enum {
+    CMD_QUIT  = 0,
+    CMD_START = 1,
+    CMD_STOP  = 2
+};
+
+typedef struct {
+    int                     init;
+    GpsCallbacks            callbacks;
+    GpsSvExtCallbacks       sv_ext_callbacks;
+    GpsSvDeltaCallbacks     sv_delta_callbacks;
+    pthread_t               thread;
+    int                     control[2];
+    char                    path[ PROPERTY_VALUE_MAX ];
+    double                  speed;
+    GpsDispatch             dispatch;
+} GpsState;
+
+static GpsState  _gps_state[1];
+
+/* parsing state of the replay thread */
+typedef struct {
+    GpsState*       state;
+    ReplaySource    source;
+    NmeaReader      reader[1];
+    NmeaFramer      framer[1];
+    NmeaBatch       batch;
+    int             split;
+    int             started;
+    GpsSvDeltaState         sv_delta;
+    gps_sv_delta_callback   sv_delta_cb;    /* the one sv_delta was sent to */
+    GpsSvDelta              delta;
+} ReplaySession;
+
+
+/* unlike the other SV reports deltas are only sent when something changed,
+ * and a new callback starts from the whole table
+ */
+static void
+replay_session_sv_delta( ReplaySession*  s, const GpsSvExtStatus*  sv )
+{
+    gps_sv_delta_callback  cb = s->state->sv_delta_callbacks.sv_delta_cb;
+
+    if (cb == NULL)
+        return;
+    if (cb != s->sv_delta_cb) {
+        gps_sv_delta_reset( &s->sv_delta );
+        s->sv_delta_cb = cb;
+    }
+    if (gps_sv_delta_update( &s->sv_delta, sv, &s->delta ) > 0 &&
+        gps_dispatch_sv_delta( &s->state->dispatch, &s->delta ) < 0)
+        gps_sv_delta_reset( &s->sv_delta );
+}
+
+
+static void
+replay_session_flush( ReplaySession*  s )
+{
+    if (s->batch.count > 0) {
+        gps_dispatch_nmea( &s->state->dispatch, &s->batch );
+        nmea_batch_reset( &s->batch );
+    }
+}
+
+
+static void
+replay_session_sentence( void*  opaque, const char*  p, const char*  end )
+{
+    ReplaySession*  s = opaque;
+
+    s->split = 0;
+    nmea_reader_parse( s->reader, p, end );
+
+    if (s->state->callbacks.nmea_cb) {
+        struct timeval  tv;
+        int64_t         now;
+
+        if (s->split & NMEA_EPOCH_NEXT)
+            replay_session_flush( s );
+
+        gettimeofday( &tv, NULL );
+        now = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        if (nmea_batch_add( &s->batch, p, end, now ) < 0) {
+            replay_session_flush( s );
+            nmea_batch_add( &s->batch, p, end, now );
+        }
+
+        if (s->split & NMEA_EPOCH_END)
+            replay_session_flush( s );
+    }
+}
+
+
+static void
+replay_session_epoch( void*  opaque, NmeaReader*  r, int  what )
+{
+    ReplaySession*  s = opaque;
+
+    s->split |= what & (NMEA_EPOCH_END | NMEA_EPOCH_NEXT);
+
+    /* NMEA_EPOCH_NEXT was seen coming by replay_session_run() */
+    if (what & NMEA_EPOCH_END)
+        replay_source_epoch( &s->source, r->epoch_tod );
+
+    /* every epoch is delivered, replay is about exercising that path */
+    if (what & NMEA_EPOCH_FIX)
+        gps_dispatch_fix( &s->state->dispatch, &r->fix, 0 );
+    if (what & NMEA_EPOCH_SV) {
+        gps_dispatch_sv( &s->state->dispatch, &r->sv_status );
+        if (s->state->sv_ext_callbacks.sv_ext_status_cb)
+            gps_dispatch_sv_ext( &s->state->dispatch, &r->sv_ext );
+        replay_session_sv_delta( s, &r->sv_ext );
+    }
+}
+
+
+static void
+replay_session_reader_init( ReplaySession*  s )
+{
+    nmea_reader_init( s->reader );
+    nmea_reader_set_checksum_mode( s->reader, NMEA_CHECKSUM_VERIFY );
+    nmea_reader_set_callback( s->reader, replay_session_epoch, s );
+}
+
+
+/* feed the chunks that are due, returns the time to wait in ms before
+ * the next one, or -1 when there is nothing left to do
+ */
+static int
+replay_session_run( ReplaySession*  s )
+{
+    ReplaySource*  src = &s->source;
+    int            count = 0;
+
+    while (s->started && src->pending != NULL) {
+        /* a line that ends the current epoch by starting the next one
+         * waits before it is parsed, like the line after a last sentence
+         */
+        if (src->capture == NULL && !src->paced) {
+            src->paced = 1;
+            if (nmea_reader_next_epoch( s->reader, src->pending,
+                                        src->pending + src->pending_len )) {
+                replay_source_epoch( src, s->reader->epoch_tod );
+                if (src->speed > 0)
+                    src->due += src->epoch_delay / src->speed;
+                src->epoch_delay = 0;
+            }
+        }
+
+        if (src->speed > 0) {
+            double  now = replay_now_ms();
+            if (now < src->due)
+                return (int)(src->due - now) + 1;
+        } else if (count++ == REPLAY_BURST)
+            return 0;
+
+        nmea_framer_feed( s->framer, src->pending, src->pending_len );
+        replay_source_fetch( src );
+
+        if (src->pending == NULL) {
+            LOGD("replay finished: %u sentences, %u bad checksum",
+                 s->reader->stats.sentences, s->reader->stats.bad_checksum);
+            replay_session_flush( s );
+        }
+    }
+    return -1;
+}
+
+
+static void*
+replay_thread( void*  arg )
+{
+    GpsState*            state = arg;
+    ReplaySession*       s;
+    struct epoll_event   ev;
+    int                  epoll_fd   = epoll_create(1);
+    int                  control_fd = state->control[1];
+
+    s = calloc( 1, sizeof(*s) );
+    if (s == NULL || replay_source_open( &s->source, state->path, state->speed ) < 0) {
+        free( s );
+        close( epoll_fd );
+        return NULL;
+    }
+    s->state = state;
+    replay_session_reader_init( s );
+    nmea_framer_init( s->framer, replay_session_sentence, s );
+    replay_source_fetch( &s->source );
+
+    ev.events  = EPOLLIN;
+    ev.data.fd = control_fd;
+    epoll_ctl( epoll_fd, EPOLL_CTL_ADD, control_fd, &ev );
+
+    for (;;) {
+        int   timeout = replay_session_run( s );
+        int   nevents;
+        char  cmd = 255;
+
+        nevents = epoll_wait( epoll_fd, &ev, 1, timeout );
+        if (nevents < 0) {
+            if (errno != EINTR)
+                LOGE("epoll_wait() unexpected error: %s", strerror(errno));
+            continue;
+        }
+        if (nevents == 0)
+            continue;
+
+        if (read( control_fd, &cmd, 1 ) != 1 || cmd == CMD_QUIT) {
+            D("replay thread quitting on demand");
+            break;
+        }
+        if (cmd == CMD_START && !s->started) {
+            /* a finished playback starts again from the beginning */
+            if (s->source.pending == NULL) {
+                if (replay_source_rewind( &s->source ) < 0)
+                    LOGE("could not rewind %s", state->path);
+                replay_session_reader_init( s );
+                replay_source_fetch( &s->source );
+            }
+            s->started     = 1;
+            s->source.due  = replay_now_ms();
+            nmea_batch_reset( &s->batch );
+            gps_sv_delta_reset( &s->sv_delta );
+            gps_dispatch_status( &state->dispatch, GPS_STATUS_SESSION_BEGIN );
+        }
+        else if (cmd == CMD_STOP && s->started) {
+            s->started = 0;
+            replay_session_flush( s );
+            gps_dispatch_status( &state->dispatch, GPS_STATUS_SESSION_END );
+        }
+    }
+
+    replay_source_close( &s->source );
+    free( s );
+    close( epoll_fd );
+    return NULL;
+}
+
+
+static void
+gps_state_send( GpsState*  s, char  cmd )
+{
+    int  ret;
+
+    do { ret = write( s->control[0], &cmd, 1 ); }
+    while (ret < 0 && errno == EINTR);
+
+    if (ret != 1)
+        D("%s: could not send command %d: ret=%d: %s",
+          __FUNCTION__, cmd, ret, strerror(errno));
+}
+
+
+static void
+gps_state_done( GpsState*  s )
+{
+    void*  dummy;
+
+    gps_state_send( s, CMD_QUIT );
+    pthread_join( s->thread, &dummy );
+
+    gps_dispatch_status( &s->dispatch, GPS_STATUS_ENGINE_OFF );
+    gps_dispatch_done( &s->dispatch );
+
+    close( s->control[0] ); s->control[0] = -1;
+    close( s->control[1] ); s->control[1] = -1;
+    s->init = 0;
+}
+
+
+static int
+gps_state_init( GpsState*  s )
+{
+    char  speed[ PROPERTY_VALUE_MAX ];
+
+    if (property_get( REPLAY_FILE_PROPERTY, s->path, "" ) <= 0)
+        return -1;
+
+    property_get( REPLAY_SPEED_PROPERTY, speed, "1" );
+    s->speed = strcmp( speed, "max" ) ? strtod( speed, NULL ) : 0;
+    if (s->speed < 0)
+        s->speed = 0;
+
+    s->control[0] = -1;
+    s->control[1] = -1;
+    if ( socketpair( AF_LOCAL, SOCK_STREAM, 0, s->control ) < 0 ) {
+        LOGE("could not create thread control socket pair: %s", strerror(errno));
+        return -1;
+    }
+    if ( gps_dispatch_init( &s->dispatch, &s->callbacks ) < 0 ) {
+        close( s->control[0] );
+        close( s->control[1] );
+        return -1;
+    }
+    s->dispatch.sv_ext_callbacks   = &s->sv_ext_callbacks;
+    s->dispatch.sv_delta_callbacks = &s->sv_delta_callbacks;
+    if ( pthread_create( &s->thread, NULL, replay_thread, s ) != 0 ) {
+        LOGE("could not create replay thread: %s", strerror(errno));
+        gps_dispatch_done( &s->dispatch );
+        close( s->control[0] );
+        close( s->control[1] );
+        return -1;
+    }
+    s->init = 1;
+    D("replaying %s at speed %g", s->path, s->speed);
+    return 0;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       I N T E R F A C E                               *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static int
+replay_gps_init(GpsCallbacks* callbacks)
+{
+    GpsState*  s = _gps_state;
+
+    s->callbacks = *callbacks;
+    if (!s->init && gps_state_init(s) < 0)
+        return -1;
+
+    gps_dispatch_status( &s->dispatch, GPS_STATUS_ENGINE_ON );
+    return 0;
+}
+
+static void
+replay_gps_cleanup(void)
+{
+    GpsState*  s = _gps_state;
+
+    if (s->init)
+        gps_state_done(s);
+}
+
+static int
+replay_gps_start()
+{
+    GpsState*  s = _gps_state;
+
+    if (!s->init) {
+        D("%s: called with uninitialized state !!", __FUNCTION__);
+        return -1;
+    }
+    gps_state_send( s, CMD_START );
+    return 0;
+}
+
+static int
+replay_gps_stop()
+{
+    GpsState*  s = _gps_state;
+
+    if (!s->init) {
+        D("%s: called with uninitialized state !!", __FUNCTION__);
+        return -1;
+    }
+    gps_state_send( s, CMD_STOP );
+    return 0;
+}
+
+static int
+replay_gps_inject_time(GpsUtcTime time, int64_t timeReference, int uncertainty)
+{
+    return 0;
+}
+
+static int
+replay_gps_inject_location(double latitude, double longitude, float accuracy)
+{
+    return 0;
+}
+
+static void
+replay_gps_delete_aiding_data(GpsAidingData flags)
+{
+}
+
+static int
+replay_gps_set_position_mode(GpsPositionMode mode, int fix_frequency)
+{
+    // the recorded receiver rate is replayed as is
+    return 0;
+}
+
+static int
+replay_gps_sv_ext_init(GpsSvExtCallbacks* callbacks)
+{
+    GpsState*  s = _gps_state;
+
+    if (callbacks)
+        s->sv_ext_callbacks = *callbacks;
+    else
+        memset( &s->sv_ext_callbacks, 0, sizeof(s->sv_ext_callbacks) );
+    return 0;
+}
+
+static const GpsSvExtInterface  replaySvExtInterface = {
+    replay_gps_sv_ext_init,
+};
+
+static int
+replay_gps_sv_delta_init(GpsSvDeltaCallbacks* callbacks)
+{
+    GpsState*  s = _gps_state;
+
+    if (callbacks)
+        s->sv_delta_callbacks = *callbacks;
+    else
+        memset( &s->sv_delta_callbacks, 0, sizeof(s->sv_delta_callbacks) );
+    return 0;
+}
+
+static const GpsSvDeltaInterface  replaySvDeltaInterface = {
+    replay_gps_sv_delta_init,
+};
+
+static const void*
+replay_gps_get_extension(const char* name)
+{
+    if (!strcmp( name, GPS_SV_EXT_INTERFACE ))
+        return &replaySvExtInterface;
+    if (!strcmp( name, GPS_SV_DELTA_INTERFACE ))
+        return &replaySvDeltaInterface;
+    return NULL;
+}
+
+static const GpsInterface  replayGpsInterface = {
+    replay_gps_init,
+    replay_gps_start,
+    replay_gps_stop,
+    replay_gps_cleanup,
+    replay_gps_inject_time,
+    replay_gps_inject_location,
+    replay_gps_delete_aiding_data,
+    replay_gps_set_position_mode,
+    replay_gps_get_extension,
+};
+
+const GpsInterface* gps_get_replay_interface()
+{
+    char  path[ PROPERTY_VALUE_MAX ];
+
+    if (property_get( REPLAY_FILE_PROPERTY, path, "" ) <= 0)
+        return NULL;
+    return &replayGpsInterface;
+}
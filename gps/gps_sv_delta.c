@@ -0,0 +1,89 @@
+#include <math.h>
+#include <string.h>
+
+#include "gps_sv_delta.h"
+
+static int
+gps_sv_delta_moved( const GpsSvExtInfo*  last, const GpsSvExtInfo*  info )
+{
+    float  az = fabsf( info->azimuth - last->azimuth );
+
+    if (az > 180.f)
+        az = 360.f - az;
+
+    return info->flags != last->flags ||
+           fabsf( info->snr - last->snr ) >= GPS_SV_DELTA_SNR ||
+           fabsf( info->elevation - last->elevation ) >= GPS_SV_DELTA_ELEVATION ||
+           az >= GPS_SV_DELTA_AZIMUTH;
+}
+
+
+void
+gps_sv_delta_reset( GpsSvDeltaState*  s )
+{
+    s->primed = 0;
+}
+
+
+int
+gps_sv_delta_update( GpsSvDeltaState*  s, const GpsSvExtStatus*  sv, GpsSvDelta*  delta )
+{
+    uint32_t  seen[ GPS_SV_EXT_MASK_WORDS ];
+    int       reset = !s->primed;
+    int       changes;
+    int       i, w;
+
+    memset( seen, 0, sizeof(seen) );
+    if (reset)
+        memset( s->present, 0, sizeof(s->present) );
+
+    delta->reset        = reset;
+    delta->num_svs      = sv->num_svs;
+    delta->num_used_svs = sv->num_used_svs;
+    delta->num_changes  = 0;
+
+    for (i = 0; i < sv->num_svs; i++) {
+        const GpsSvExtInfo*  info = &sv->sv_list[i];
+        int                  slot = gps_sv_ext_slot( info->constellation, info->svid );
+
+        if (slot < 0 || gps_sv_ext_test( seen, slot ))
+            continue;
+        gps_sv_ext_set( seen, slot );
+
+        if (gps_sv_ext_test( s->present, slot ) &&
+            !gps_sv_delta_moved( &s->last[slot], info ))
+            continue;
+
+        s->last[slot] = *info;
+        delta->changes[ delta->num_changes++ ] = *info;
+    }
+
+    /* satellites that are gone. when they don't all fit, send the whole
+     * table instead, it is never larger than GPS_SV_EXT_MAX_SVS.
+     */
+    for (w = 0; w < GPS_SV_EXT_MASK_WORDS; w++) {
+        uint32_t  gone = s->present[w] & ~seen[w];
+
+        while (gone) {
+            int  slot = w * 32 + __builtin_ctz(gone);
+
+            gone &= gone - 1;
+            if (delta->num_changes == GPS_SV_EXT_MAX_SVS) {
+                s->primed = 0;
+                return gps_sv_delta_update( s, sv, delta );
+            }
+            delta->changes[ delta->num_changes ] = s->last[slot];
+            delta->changes[ delta->num_changes ].flags = GPS_SV_EXT_REMOVED;
+            delta->num_changes += 1;
+        }
+    }
+    memcpy( s->present, seen, sizeof(seen) );
+
+    changes = delta->num_changes;
+    if (reset || sv->num_used_svs != s->num_used_svs)
+        changes += 1;
+
+    s->num_used_svs = sv->num_used_svs;
+    s->primed       = 1;
+    return changes;
+}
@@ -0,0 +1,34 @@
+#ifndef _gps_sv_delta_h
+#define _gps_sv_delta_h
+
+#include <hardware_legacy/gps_sv_ext.h>
+
+/* a satellite is reported again once one of its values moved past these
+ * from what was last delivered, or its flags changed. GSV carries whole
+ * degrees and dB-Hz, so anything smaller is noise.
+ */
+#define  GPS_SV_DELTA_SNR        2.0f   /* dB-Hz */
+#define  GPS_SV_DELTA_ELEVATION  2.0f   /* degrees */
+#define  GPS_SV_DELTA_AZIMUTH    3.0f   /* degrees */
+
+/* what was last delivered, per slot */
+typedef struct {
+    int             primed;     /* a table was delivered since the reset */
+    int             num_used_svs;
+    uint32_t        present[ GPS_SV_EXT_MASK_WORDS ];
+    GpsSvExtInfo    last[ GPS_SV_EXT_SLOTS ];
+} GpsSvDeltaState;
+
+/* the next delta will hold the whole table */
+extern void
+gps_sv_delta_reset( GpsSvDeltaState*  s );
+
+/* compare a new satellite report with what was last delivered, fill
+ * 'delta' with the changes and remember them as delivered. returns the
+ * number of changes, 0 if the report can be skipped. a change in the
+ * number of satellites used counts as one without an entry.
+ */
+extern int
+gps_sv_delta_update( GpsSvDeltaState*  s, const GpsSvExtStatus*  sv, GpsSvDelta*  delta );
+
+#endif /* _gps_sv_delta_h */
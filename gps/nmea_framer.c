@@ -0,0 +1,156 @@
+#include <string.h>
+
+#define  LOG_TAG  "gps_nmea"
+#include <cutils/log.h>
+
+#include "nmea_framer.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   F R A M E R                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+void
+nmea_framer_init( NmeaFramer*  f, nmea_framer_func  func, void*  opaque )
+{
+    memset( f, 0, sizeof(*f) );
+    f->func   = func;
+    f->opaque = opaque;
+}
+
+
+void
+nmea_framer_reset( NmeaFramer*  f )
+{
+    f->pos      = 0;
+    f->overflow = 0;
+}
+
+
+static void
+nmea_framer_emit( NmeaFramer*  f, const char*  p, const char*  end )
+{
+    const char*  q;
+
+    /* a sentence starts at its '$', anything before the last one in the
+     * line is either noise or the remains of a sentence that lost its
+     * terminator on the wire.
+     */
+    q = memchr( p, '$', end - p );
+    if (q != NULL) {
+        const char*  r;
+        while ((r = memchr( q+1, '$', end - (q+1) )) != NULL)
+            q = r;
+        if (q > p)
+            D("skipping %d bytes of noise", (int)(q - p));
+        p = q;
+    }
+
+    f->func( f->opaque, p, end );
+}
+
+
+void
+nmea_framer_feed( NmeaFramer*  f, const char*  buf, int  len )
+{
+    const char*  p   = buf;
+    const char*  end = buf + len;
+
+    while (p < end) {
+        const char*  nl = memchr( p, '\n', end - p );
+        const char*  q  = (nl != NULL) ? nl + 1 : end;
+        int          n  = q - p;
+
+        if (f->overflow) {
+            /* skip the rest of an oversized sentence */
+            if (nl != NULL)
+                f->overflow = 0;
+            p = q;
+            continue;
+        }
+
+        if (f->pos + n > NMEA_MAX_SIZE) {
+            D("sentence too long, discarded");
+            f->overflow = (nl == NULL);
+            f->pos      = 0;
+            p = q;
+            continue;
+        }
+
+        if (nl == NULL) {
+            /* incomplete sentence, keep it until the next chunk */
+            memcpy( f->in + f->pos, p, n );
+            f->pos += n;
+            break;
+        }
+
+        if (f->pos == 0) {
+            nmea_framer_emit( f, p, q );
+        } else {
+            memcpy( f->in + f->pos, p, n );
+            n     += f->pos;
+            f->pos = 0;
+            nmea_framer_emit( f, f->in, f->in + n );
+        }
+        p = q;
+    }
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   B A T C H                             *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+void
+nmea_batch_reset( NmeaBatch*  b )
+{
+    b->len   = 0;
+    b->count = 0;
+}
+
+
+int
+nmea_batch_add( NmeaBatch*  b, const char*  p, const char*  end, int64_t  timestamp )
+{
+    int  n = end - p;
+
+    if (b->len + n > NMEA_BATCH_MAX)
+        return -1;
+
+    if (b->count == 0)
+        b->timestamp = timestamp;
+    memcpy( b->buf + b->len, p, n );
+    b->len   += n;
+    b->count += 1;
+    return 0;
+}
+
+
+void
+nmea_batch_foreach( const NmeaBatch*  b, nmea_framer_func  func, void*  opaque )
+{
+    const char*  p   = b->buf;
+    const char*  end = b->buf + b->len;
+
+    while (p < end) {
+        const char*  nl = memchr( p, '\n', end - p );
+        const char*  q  = (nl != NULL) ? nl + 1 : end;
+
+        func( opaque, p, q );
+        p = q;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef _nmea_framer_h
+#define _nmea_framer_h
+
+#include <stdint.h>
+
+/* maximum size of a NMEA sentence, including the terminating <CR><LF> */
+#define  NMEA_MAX_SIZE  83
+
+/* called by the framer for each complete sentence. 'p' points to the leading
+ * '$' when there is one, and 'end' just past the terminating '\n'. the span
+ * points either into the buffer given to nmea_framer_feed() or into the
+ * framer's own reassembly buffer, and is only valid during the call.
+ */
+typedef void (*nmea_framer_func)( void*  opaque, const char*  p, const char*  end );
+
+typedef struct {
+    int               pos;
+    int               overflow;
+    nmea_framer_func  func;
+    void*             opaque;
+    char              in[ NMEA_MAX_SIZE+1 ];
+} NmeaFramer;
+
+extern void
+nmea_framer_init( NmeaFramer*  f, nmea_framer_func  func, void*  opaque );
+
+/* drop any partially received sentence */
+extern void
+nmea_framer_reset( NmeaFramer*  f );
+
+/* split a chunk of bytes read from the receiver into sentences. sentences
+ * that are entirely contained in 'buf' are handed out without being copied,
+ * only the pieces straddling two chunks go through the reassembly buffer.
+ */
+extern void
+nmea_framer_feed( NmeaFramer*  f, const char*  buf, int  len );
+
+/* raw sentences collected for a single dispatch, normally one epoch. they
+ * still go to nmea_cb one by one, the framework only has room for one.
+ */
+#define  NMEA_BATCH_MAX  1024
+
+typedef struct {
+    int64_t  timestamp;         /* reception time of the first sentence, in ms */
+    int      len;
+    int      count;             /* number of sentences in buf */
+    char     buf[ NMEA_BATCH_MAX ];
+} NmeaBatch;
+
+extern void
+nmea_batch_reset( NmeaBatch*  b );
+
+/* append a sentence received at 'timestamp'. returns -1 without adding
+ * anything when it doesn't fit, the caller should flush and retry.
+ */
+extern int
+nmea_batch_add( NmeaBatch*  b, const char*  p, const char*  end, int64_t  timestamp );
+
+/* call 'func' for each sentence of the batch, in order, as the framer did */
+extern void
+nmea_batch_foreach( const NmeaBatch*  b, nmea_framer_func  func, void*  opaque );
+
+#endif /* _nmea_framer_h */
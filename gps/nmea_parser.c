@@ -0,0 +1,1188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define  LOG_TAG  "gps_nmea"
+#include <cutils/log.h>
+
+#include "nmea_parser.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+static void nmea_dispatch_init( void );
+static void nmea_reader_publish_sv( NmeaReader*  r );
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   T O K E N I Z E R                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static int
+nmea_hex( int  c )
+{
+    if ((unsigned)(c - '0') < 10)
+        return c - '0';
+    if ((unsigned)(c - 'A') < 6)
+        return c - 'A' + 10;
+    if ((unsigned)(c - 'a') < 6)
+        return c - 'a' + 10;
+    return -1;
+}
+
+
+int
+nmea_tokenizer_init_checked( NmeaTokenizer*  t, const char*  p, const char*  end, int  mode )
+{
+    int            count = 0;
+    unsigned char  sum   = 0;
+    const char*    q;
+
+    // the initial '$' is optional
+    if (p < end && p[0] == '$')
+        p += 1;
+
+    // remove trailing newline
+    if (end > p && end[-1] == '\n') {
+        end -= 1;
+        if (end > p && end[-1] == '\r')
+            end -= 1;
+    }
+
+    // split fields and compute the checksum in the same pass. empty fields
+    // are kept, sentence fields are addressed by position
+    for (q = p; q < end && *q != '*'; q++) {
+        sum ^= (unsigned char)*q;
+        if (*q == ',') {
+            if (count < MAX_NMEA_TOKENS) {
+                t->tokens[count].p   = p;
+                t->tokens[count].end = q;
+                count += 1;
+            }
+            p = q + 1;
+        }
+    }
+    if (count < MAX_NMEA_TOKENS && (q > p || count > 0)) {
+        t->tokens[count].p   = p;
+        t->tokens[count].end = q;
+        count += 1;
+    }
+    t->count = count;
+
+    if (mode == NMEA_CHECKSUM_IGNORE)
+        return count;
+
+    // q is at the '*' that starts the checksum, if there is one
+    if (q == end)
+        return (mode == NMEA_CHECKSUM_REQUIRE) ? -1 : count;
+
+    if (end - q == 3) {
+        int  hi = nmea_hex(q[1]);
+        int  lo = nmea_hex(q[2]);
+
+        if (hi >= 0 && lo >= 0 && ((hi << 4) | lo) == sum)
+            return count;
+    }
+    D("bad checksum, computed %02X", sum);
+    return -1;
+}
+
+
+int
+nmea_tokenizer_init( NmeaTokenizer*  t, const char*  p, const char*  end )
+{
+    return nmea_tokenizer_init_checked( t, p, end, NMEA_CHECKSUM_IGNORE );
+}
+
+
+Token
+nmea_tokenizer_get( NmeaTokenizer*  t, int  index )
+{
+    Token  tok;
+    static const char*  dummy = "";
+
+    if (index < 0 || index >= t->count) {
+        tok.p = tok.end = dummy;
+    } else
+        tok = t->tokens[index];
+
+    return tok;
+}
+
+
+static int
+str2int( const char*  p, const char*  end )
+{
+    int   result = 0;
+    int   len    = end - p;
+
+    if (len == 0)
+        return -1;
+
+    for ( ; len > 0; len--, p++ )
+    {
+        int  c;
+
+        if (p >= end)
+            goto Fail;
+
+        c = *p - '0';
+        if ((unsigned)c >= 10)
+            goto Fail;
+
+        result = result*10 + c;
+    }
+    return  result;
+
+Fail:
+    return -1;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   D E C I M A L S                       *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static const long long  nmea_pow10[NMEA_DECIMAL_MAX_FRAC+1] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL,
+    1000000LL, 10000000LL, 100000000LL, 1000000000LL
+};
+
+/* larger integer parts cannot be represented, and don't appear in NMEA */
+#define  NMEA_DECIMAL_MAX_MANT  (1LL << 53)
+
+int
+nmea_decimal_decode( const char*  p, const char*  end, NmeaDecimal*  d )
+{
+    long long  mant   = 0;
+    int        frac   = -1;     /* -1 until the decimal point is seen */
+    int        digits = 0;
+    int        neg    = 0;
+
+    if (p < end && (p[0] == '-' || p[0] == '+')) {
+        neg = (p[0] == '-');
+        p  += 1;
+    }
+
+    for ( ; p < end; p++ ) {
+        unsigned  c = (unsigned)(*p - '0');
+
+        if (c < 10) {
+            digits += 1;
+            if (frac >= NMEA_DECIMAL_MAX_FRAC)
+                continue;
+            mant = mant*10 + c;
+            if (mant >= NMEA_DECIMAL_MAX_MANT)
+                return -1;
+            if (frac >= 0)
+                frac += 1;
+        } else if (*p == '.' && frac < 0) {
+            frac = 0;
+        } else {
+            return -1;
+        }
+    }
+
+    if (digits == 0)
+        return -1;
+
+    d->mant = neg ? -mant : mant;
+    d->frac = (frac < 0) ? 0 : frac;
+    return 0;
+}
+
+
+double
+nmea_decimal_to_double( const NmeaDecimal*  d )
+{
+    /* both operands are exact, so the single division rounds correctly */
+    if (d->frac == 0)
+        return (double) d->mant;
+
+    return (double) d->mant / (double) nmea_pow10[d->frac];
+}
+
+
+double
+nmea_decode_coord( const char*  p, const char*  end )
+{
+    NmeaDecimal  d;
+    long long    unit, degrees, minutes;
+
+    if (nmea_decimal_decode(p, end, &d) < 0 || d.mant < 0)
+        return -1.;
+
+    /* split degrees and minutes on the integer mantissa, so that only
+     * the final division can introduce a rounding error.
+     */
+    unit    = 100 * nmea_pow10[d.frac];
+    degrees = d.mant / unit;
+    minutes = d.mant - degrees * unit;
+
+    return (double) degrees + (double) minutes / (60. * nmea_pow10[d.frac]);
+}
+
+
+int
+nmea_decode_time( const char*  p, const char*  end )
+{
+    NmeaDecimal  d;
+    long long    scale, secs, frac;
+    int          hour, minute, second;
+
+    if (end - p < 6 || nmea_decimal_decode(p, end, &d) < 0 || d.mant < 0)
+        return -1;
+
+    scale  = nmea_pow10[d.frac];
+    secs   = d.mant / scale;
+    frac   = d.mant - secs * scale;
+
+    hour   = (int)(secs / 10000);
+    minute = (int)(secs / 100 % 100);
+    second = (int)(secs % 100);
+    if (hour >= 24 || minute >= 60 || second >= 61)
+        return -1;
+
+    return ((hour * 60 + minute) * 60 + second) * 1000 + (int)(frac * 1000 / scale);
+}
+
+
+static double
+str2float( const char*  p, const char*  end )
+{
+    NmeaDecimal  d;
+
+    if (p >= end)
+        return -1.0;
+
+    if (nmea_decimal_decode(p, end, &d) < 0)
+        return 0.;
+
+    return nmea_decimal_to_double(&d);
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   P A R S E R                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+void
+nmea_reader_init( NmeaReader*  r )
+{
+    memset( r, 0, sizeof(*r) );
+
+    r->utc_year = -1;
+    r->utc_mon  = -1;
+    r->utc_day  = -1;
+    r->utc_tod  = -1;
+    r->epoch_tod = -1;
+    r->callback = NULL;
+
+    nmea_dispatch_init();
+}
+
+
+void
+nmea_reader_set_checksum_mode( NmeaReader*  r, int  mode )
+{
+    r->checksum_mode = mode;
+}
+
+
+void
+nmea_reader_set_callback( NmeaReader*  r, nmea_epoch_func  func, void*  opaque )
+{
+    r->callback        = func;
+    r->callback_opaque = opaque;
+}
+
+
+/* days since 1970-01-01 for a proleptic gregorian date */
+static long
+nmea_days_from_civil( int  y, int  m, int  d )
+{
+    long  era, yoe, doy, doe;
+
+    y  -= (m <= 2);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+
+/* the UTC epoch of the current day is only recomputed when the date
+ * changes, a timestamp is then a single addition. the time of day of the
+ * previous date is forgotten, so that the next time isn't taken for a
+ * wrap-around past midnight on top of the new date.
+ */
+static void
+nmea_reader_set_date( NmeaReader*  r, int  year, int  mon, int  day )
+{
+    if (year == r->utc_year && mon == r->utc_mon && day == r->utc_day)
+        return;
+
+    r->utc_year  = year;
+    r->utc_mon   = mon;
+    r->utc_day   = day;
+    r->utc_tod   = -1;
+    r->day_epoch = (GpsUtcTime) nmea_days_from_civil(year, mon, day) * 86400000LL;
+}
+
+
+static int
+nmea_reader_update_time( NmeaReader*  r, Token  tok )
+{
+    int  tod;
+
+    tod = nmea_decode_time(tok.p, tok.end);
+    if (tod < 0)
+        return -1;
+
+    if (r->utc_year < 0) {
+        // no date yet, get current one
+        time_t     now = time(NULL);
+        struct tm  tm;
+
+        gmtime_r( &now, &tm );
+        nmea_reader_set_date( r, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday );
+    } else if (tod + 43200000 < r->utc_tod) {
+        // the time of day wrapped around before a new date was received
+        r->day_epoch += 86400000LL;
+    }
+
+    r->utc_tod       = tod;
+    r->fix.timestamp = r->day_epoch + tod;
+    return 0;
+}
+
+static int
+nmea_reader_update_cdate( NmeaReader*  r, Token  tok_d, Token  tok_m, Token  tok_y )
+{
+    int    day, mon, year;
+
+    if ( (tok_d.p + 2 > tok_d.end) ||
+         (tok_m.p + 2 > tok_m.end) ||
+         (tok_y.p + 4 > tok_y.end) )
+        return -1;
+
+    day  = str2int(tok_d.p, tok_d.p+2);
+    mon  = str2int(tok_m.p, tok_m.p+2);
+    year = str2int(tok_y.p, tok_y.p+4);
+
+    if ((day|mon|year) < 0)
+        return -1;
+
+    nmea_reader_set_date( r, year, mon, day );
+    return 0;
+}
+
+static int
+nmea_reader_update_date( NmeaReader*  r, Token  date, Token  time )
+{
+    Token  tok = date;
+    int    day, mon, year;
+
+    if (tok.p + 6 != tok.end) {
+        D("date not properly formatted: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
+    day  = str2int(tok.p, tok.p+2);
+    mon  = str2int(tok.p+2, tok.p+4);
+    year = str2int(tok.p+4, tok.p+6) + 2000;
+
+    if ((day|mon|year) < 0) {
+        D("date not properly formatted: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
+
+    nmea_reader_set_date( r, year, mon, day );
+
+    return nmea_reader_update_time( r, time );
+}
+
+
+static double
+convert_from_hhmm( Token  tok )
+{
+    return nmea_decode_coord(tok.p, tok.end);
+}
+
+
+static int
+nmea_reader_update_latlong( NmeaReader*  r,
+                            Token        latitude,
+                            char         latitudeHemi,
+                            Token        longitude,
+                            char         longitudeHemi )
+{
+    double   lat, lon;
+    Token    tok;
+
+    tok = latitude;
+    if (tok.p + 6 > tok.end) {
+        D("latitude is too short: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
+    lat = convert_from_hhmm(tok);
+    if (lat < 0) {
+        D("latitude is malformed: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
+    if (latitudeHemi == 'S')
+        lat = -lat;
+
+    tok = longitude;
+    if (tok.p + 6 > tok.end) {
+        D("longitude is too short: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
+    lon = convert_from_hhmm(tok);
+    if (lon < 0) {
+        D("longitude is malformed: '%.*s'", tok.end-tok.p, tok.p);
+        return -1;
+    }
+    if (longitudeHemi == 'W')
+        lon = -lon;
+
+    r->fix.flags    |= GPS_LOCATION_HAS_LAT_LONG;
+    r->fix.latitude  = lat;
+    r->fix.longitude = lon;
+    return 0;
+}
+
+
+static int
+nmea_reader_update_altitude( NmeaReader*  r,
+                             Token        altitude,
+                             Token        units )
+{
+    Token   tok = altitude;
+
+    if (tok.p >= tok.end)
+        return -1;
+
+    r->fix.flags   |= GPS_LOCATION_HAS_ALTITUDE;
+    r->fix.altitude = str2float(tok.p, tok.end);
+    return 0;
+}
+
+
+static int
+nmea_reader_update_accuracy( NmeaReader*  r,
+                             Token        accuracy )
+{
+    Token        tok = accuracy;
+    NmeaDecimal  d;
+
+    if (nmea_decimal_decode(tok.p, tok.end, &d) < 0)
+        return -1;
+
+    r->fix.accuracy = nmea_decimal_to_double(&d);
+
+    // 99.99 means no solution, compare the exact decimal value
+    if (d.frac >= 2 && d.mant == 9999 * nmea_pow10[d.frac-2])
+        return 0;
+
+    r->fix.flags |= GPS_LOCATION_HAS_ACCURACY;
+    return 0;
+}
+
+
+static int
+nmea_reader_update_bearing( NmeaReader*  r,
+                            Token        bearing )
+{
+    Token   tok = bearing;
+
+    if (tok.p >= tok.end)
+        return -1;
+
+    r->fix.flags   |= GPS_LOCATION_HAS_BEARING;
+    r->fix.bearing  = str2float(tok.p, tok.end);
+    return 0;
+}
+
+
+static int
+nmea_reader_update_speed( NmeaReader*  r,
+                          Token        speed )
+{
+    Token   tok = speed;
+
+    if (tok.p >= tok.end)
+        return -1;
+
+    r->fix.flags   |= GPS_LOCATION_HAS_SPEED;
+    r->fix.speed    = str2float(tok.p, tok.end) * 0.514444;   // knots to m/s
+    return 0;
+}
+
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       S E N T E N C E   H A N D L E R S               *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static void
+nmea_reader_parse_gga( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_fixStatus     = nmea_tokenizer_get(tzer,6);
+
+    if (tok_fixStatus.p[0] > '0') {
+        Token  tok_time          = nmea_tokenizer_get(tzer,1);
+        Token  tok_latitude      = nmea_tokenizer_get(tzer,2);
+        Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,3);
+        Token  tok_longitude     = nmea_tokenizer_get(tzer,4);
+        Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,5);
+        Token  tok_usedInFix     = nmea_tokenizer_get(tzer,7);
+        Token  tok_altitude      = nmea_tokenizer_get(tzer,9);
+        Token  tok_altitudeUnits = nmea_tokenizer_get(tzer,10);
+
+        nmea_reader_update_time(r, tok_time);
+        nmea_reader_update_latlong(r, tok_latitude,
+                                      tok_latitudeHemi.p[0],
+                                      tok_longitude,
+                                      tok_longitudeHemi.p[0]);
+        nmea_reader_update_altitude(r, tok_altitude, tok_altitudeUnits);
+        r->sv_status.num_used_svs = str2int(tok_usedInFix.p, tok_usedInFix.end);
+        r->sv_ext.num_used_svs    = r->sv_status.num_used_svs;
+    }
+}
+
+
+static void
+nmea_reader_parse_gll( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_fixStatus     = nmea_tokenizer_get(tzer,6);
+
+    if (tok_fixStatus.p[0] == 'A') {
+        Token  tok_latitude      = nmea_tokenizer_get(tzer,1);
+        Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,2);
+        Token  tok_longitude     = nmea_tokenizer_get(tzer,3);
+        Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,4);
+        Token  tok_time          = nmea_tokenizer_get(tzer,5);
+
+        nmea_reader_update_time(r, tok_time);
+        nmea_reader_update_latlong(r, tok_latitude,
+                                      tok_latitudeHemi.p[0],
+                                      tok_longitude,
+                                      tok_longitudeHemi.p[0]);
+    }
+}
+
+
+static void
+nmea_reader_parse_gsa( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_fixStatus     = nmea_tokenizer_get(tzer,2);
+    int    i;
+
+    if (tok_fixStatus.p[0] != '\0' && tok_fixStatus.p[0] != '1') {
+        Token  tok_accuracy      = nmea_tokenizer_get(tzer,15);
+
+        nmea_reader_update_accuracy(r, tok_accuracy);
+
+        /* multi-constellation receivers send one GSA per system in a
+         * row, only the first one of a series starts a new mask.
+         */
+        if (r->last_sentence != NMEA_SENTENCE_ID('G','S','A')) {
+            r->sv_status.used_in_fix_mask = 0ul;
+            memset( r->sv_ext.used_in_fix_mask, 0, sizeof(r->sv_ext.used_in_fix_mask) );
+        }
+
+        for (i = 3; i <= 14; ++i) {
+            Token  tok_prn  = nmea_tokenizer_get(tzer, i);
+            int    prn      = str2int(tok_prn.p, tok_prn.end);
+            int    svid;
+            int    constellation = nmea_sv_constellation(r->talker, prn, &svid);
+            int    slot = gps_sv_ext_slot(constellation, svid);
+
+            if (slot < 0)
+                continue;
+            gps_sv_ext_set(r->sv_ext.used_in_fix_mask, slot);
+            /* the legacy mask only has room for GPS */
+            if (constellation == GPS_CONSTELLATION_GPS)
+                r->sv_status.used_in_fix_mask |= (1ul << (svid-1));
+        }
+        D("%s: fix mask is 0x%x", __FUNCTION__, r->sv_status.used_in_fix_mask);
+    }
+}
+
+
+static void
+nmea_reader_parse_gsv( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_noSatellites  = nmea_tokenizer_get(tzer,3);
+    int    noSatellites      = str2int(tok_noSatellites.p, tok_noSatellites.end);
+
+    if (noSatellites > 0) {
+        Token  tok_noSentences   = nmea_tokenizer_get(tzer,1);
+        Token  tok_sentence      = nmea_tokenizer_get(tzer,2);
+        int    sentence          = str2int(tok_sentence.p, tok_sentence.end);
+        int    totalSentences    = str2int(tok_noSentences.p, tok_noSentences.end);
+        int    i;
+
+        /* each talker sends its own GSV cycle, the list is restarted when
+         * a talker that already contributed to it begins a new cycle. a
+         * table that no epoch boundary published yet goes out first.
+         */
+        if (sentence == 1) {
+            if (r->gsv_talkers & r->talker) {
+                nmea_reader_publish_sv( r );
+                r->sv_status.num_svs = 0;
+                r->sv_ext.num_svs    = 0;
+                r->gsv_talkers       = 0;
+            }
+            r->gsv_talkers |= r->talker;
+            r->gsv_count    = 0;
+        }
+
+        /* the legacy list fills up at GPS_MAX_SVS, the extended one keeps
+         * going
+         */
+        for (i = 0; i < 4 && r->gsv_count < noSatellites; i++, r->gsv_count++) {
+            Token  tok_prn       = nmea_tokenizer_get(tzer, i * 4 + 4);
+            Token  tok_elevation = nmea_tokenizer_get(tzer, i * 4 + 5);
+            Token  tok_azimuth   = nmea_tokenizer_get(tzer, i * 4 + 6);
+            Token  tok_snr       = nmea_tokenizer_get(tzer, i * 4 + 7);
+            int    prn           = str2int(tok_prn.p, tok_prn.end);
+            float  elevation     = str2float(tok_elevation.p, tok_elevation.end);
+            float  azimuth       = str2float(tok_azimuth.p, tok_azimuth.end);
+            float  snr           = str2float(tok_snr.p, tok_snr.end);
+            int    svid;
+            int    constellation;
+
+            if (r->sv_status.num_svs < GPS_MAX_SVS) {
+                GpsSvInfo*  info = &r->sv_status.sv_list[r->sv_status.num_svs++];
+                info->prn       = prn;
+                info->elevation = elevation;
+                info->azimuth   = azimuth;
+                info->snr       = snr;
+            }
+
+            constellation = nmea_sv_constellation(r->talker, prn, &svid);
+            if (constellation != GPS_CONSTELLATION_UNKNOWN &&
+                r->sv_ext.num_svs < GPS_SV_EXT_MAX_SVS) {
+                GpsSvExtInfo*  info = &r->sv_ext.sv_list[r->sv_ext.num_svs++];
+                info->constellation = constellation;
+                info->flags         = 0;
+                info->svid          = svid;
+                info->elevation     = elevation;
+                info->azimuth       = azimuth;
+                info->snr           = snr;
+            }
+        }
+
+        /* published at the next epoch boundary, once the cycles of the
+         * other talkers are complete too
+         */
+        if (sentence == totalSentences)
+            r->sv_status_changed = 1;
+
+        D("%s: GSV message with total satellites %d", __FUNCTION__, noSatellites);
+    }
+}
+
+
+static void
+nmea_reader_parse_rmc( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_fixStatus     = nmea_tokenizer_get(tzer,2);
+
+    D("in RMC, fixStatus=%c", tok_fixStatus.p[0]);
+    if (tok_fixStatus.p[0] == 'A') {
+        Token  tok_time          = nmea_tokenizer_get(tzer,1);
+        Token  tok_latitude      = nmea_tokenizer_get(tzer,3);
+        Token  tok_latitudeHemi  = nmea_tokenizer_get(tzer,4);
+        Token  tok_longitude     = nmea_tokenizer_get(tzer,5);
+        Token  tok_longitudeHemi = nmea_tokenizer_get(tzer,6);
+        Token  tok_speed         = nmea_tokenizer_get(tzer,7);
+        Token  tok_bearing       = nmea_tokenizer_get(tzer,8);
+        Token  tok_date          = nmea_tokenizer_get(tzer,9);
+
+        nmea_reader_update_date( r, tok_date, tok_time );
+
+        nmea_reader_update_latlong( r, tok_latitude,
+                                       tok_latitudeHemi.p[0],
+                                       tok_longitude,
+                                       tok_longitudeHemi.p[0] );
+
+        nmea_reader_update_bearing( r, tok_bearing );
+        nmea_reader_update_speed  ( r, tok_speed );
+    }
+}
+
+
+static void
+nmea_reader_parse_vtg( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_fixStatus     = nmea_tokenizer_get(tzer,9);
+
+    if (tok_fixStatus.p[0] != '\0' && tok_fixStatus.p[0] != 'N') {
+        Token  tok_bearing       = nmea_tokenizer_get(tzer,1);
+        Token  tok_speed         = nmea_tokenizer_get(tzer,5);
+
+        nmea_reader_update_bearing( r, tok_bearing );
+        nmea_reader_update_speed  ( r, tok_speed );
+    }
+}
+
+
+static void
+nmea_reader_parse_zda( NmeaReader*  r, NmeaTokenizer*  tzer )
+{
+    Token  tok_time;
+    Token  tok_year          = nmea_tokenizer_get(tzer,4);
+
+    if (tok_year.p[0] != '\0') {
+        Token  tok_day           = nmea_tokenizer_get(tzer,2);
+        Token  tok_mon           = nmea_tokenizer_get(tzer,3);
+
+        nmea_reader_update_cdate( r, tok_day, tok_mon, tok_year );
+    }
+    tok_time = nmea_tokenizer_get(tzer,1);
+    if (tok_time.p[0] != '\0')
+        nmea_reader_update_time(r, tok_time);
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       S E N T E N C E   D I S P A T C H               *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+typedef void (*NmeaSentenceFunc)( NmeaReader*  r, NmeaTokenizer*  tzer );
+
+typedef struct {
+    unsigned          id;
+    int               time_field;   /* index of the UTC time field, or -1 */
+    int               epoch;        /* contributes to the fix epoch */
+    NmeaSentenceFunc  func;
+} NmeaSentence;
+
+static const NmeaSentence  _nmea_sentences[] = {
+    { NMEA_SENTENCE_ID('G','G','A'),  1, 1, nmea_reader_parse_gga },
+    { NMEA_SENTENCE_ID('G','L','L'),  5, 1, nmea_reader_parse_gll },
+    { NMEA_SENTENCE_ID('G','S','A'), -1, 1, nmea_reader_parse_gsa },
+    { NMEA_SENTENCE_ID('G','S','V'), -1, 0, nmea_reader_parse_gsv },
+    { NMEA_SENTENCE_ID('R','M','C'),  1, 1, nmea_reader_parse_rmc },
+    { NMEA_SENTENCE_ID('V','T','G'), -1, 1, nmea_reader_parse_vtg },
+    { NMEA_SENTENCE_ID('Z','D','A'),  1, 1, nmea_reader_parse_zda },
+};
+
+#define  NMEA_SENTENCE_COUNT  (sizeof(_nmea_sentences)/sizeof(_nmea_sentences[0]))
+
+/* open-addressed table indexed by a hash of the packed sentence id. the
+ * hash has no collisions for the sentences above, so a lookup is a single
+ * probe; linear probing only keeps it correct if more are added.
+ */
+#define  NMEA_DISPATCH_SIZE  32
+
+static const NmeaSentence*  _nmea_dispatch[ NMEA_DISPATCH_SIZE ];
+static int                  _nmea_dispatch_init;
+
+static unsigned
+nmea_sentence_hash( unsigned  id )
+{
+    return (id ^ (id >> 5) ^ (id >> 10)) & (NMEA_DISPATCH_SIZE-1);
+}
+
+static void
+nmea_dispatch_init( void )
+{
+    unsigned  n;
+
+    if (_nmea_dispatch_init)
+        return;
+
+    for (n = 0; n < NMEA_SENTENCE_COUNT; n++) {
+        unsigned  h = nmea_sentence_hash(_nmea_sentences[n].id);
+
+        while (_nmea_dispatch[h] != NULL)
+            h = (h + 1) & (NMEA_DISPATCH_SIZE-1);
+
+        _nmea_dispatch[h] = &_nmea_sentences[n];
+    }
+    _nmea_dispatch_init = 1;
+}
+
+static const NmeaSentence*
+nmea_dispatch_find( unsigned  id )
+{
+    unsigned  h = nmea_sentence_hash(id);
+
+    for (;;) {
+        const NmeaSentence*  s = _nmea_dispatch[h];
+
+        if (s == NULL)
+            return NULL;
+        if (s->id == id)
+            return s;
+        h = (h + 1) & (NMEA_DISPATCH_SIZE-1);
+    }
+}
+
+static int
+nmea_talker( const char*  p )
+{
+    switch ((p[0] << 8) | p[1]) {
+        case ('G' << 8) | 'P':  return NMEA_TALKER_GP;
+        case ('G' << 8) | 'L':  return NMEA_TALKER_GL;
+        case ('G' << 8) | 'A':  return NMEA_TALKER_GA;
+        case ('G' << 8) | 'N':  return NMEA_TALKER_GN;
+        case ('B' << 8) | 'D':
+        case ('G' << 8) | 'B':  return NMEA_TALKER_BD;
+        default:                return 0;
+    }
+}
+
+
+/* NMEA 4.x numbering: GPS 1-32, SBAS 33-64 (PRN - 87), GLONASS 65-96,
+ * QZSS 193-202. talkers of their own constellation may also number from
+ * 1, and some receivers offset BeiDou by 200 and Galileo by 300.
+ */
+int
+nmea_sv_constellation( int  talker, int  prn, int*  svid )
+{
+    *svid = prn;
+
+    if (talker == NMEA_TALKER_GA) {
+        if (prn > 300)
+            *svid = prn - 300;
+        return GPS_CONSTELLATION_GALILEO;
+    }
+    if (talker == NMEA_TALKER_BD) {
+        if (prn > 200)
+            *svid = prn - 200;
+        return GPS_CONSTELLATION_BEIDOU;
+    }
+    if (talker == NMEA_TALKER_GL && prn <= 32)
+        return GPS_CONSTELLATION_GLONASS;
+
+    if (prn >= 1 && prn <= 32)
+        return GPS_CONSTELLATION_GPS;
+    if (prn >= 33 && prn <= 64) {
+        *svid = prn + 87;
+        return GPS_CONSTELLATION_SBAS;
+    }
+    if (prn >= 65 && prn <= 96) {
+        *svid = prn - 64;
+        return GPS_CONSTELLATION_GLONASS;
+    }
+    if (prn >= 120 && prn <= 158)
+        return GPS_CONSTELLATION_SBAS;
+    if (prn >= 193 && prn <= 202)
+        return GPS_CONSTELLATION_QZSS;
+    if (prn >= 201 && prn <= 263) {
+        *svid = prn - 200;
+        return GPS_CONSTELLATION_BEIDOU;
+    }
+    if (prn >= 301 && prn <= 336) {
+        *svid = prn - 300;
+        return GPS_CONSTELLATION_GALILEO;
+    }
+    return GPS_CONSTELLATION_UNKNOWN;
+}
+
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       E P O C H   A S S E M B L Y                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* GSA may come before or after GSV, the used flags are only set once the
+ * cycle is complete
+ */
+static void
+nmea_reader_sv_ext_flags( GpsSvExtStatus*  sv )
+{
+    int  i;
+
+    for (i = 0; i < sv->num_svs; i++) {
+        GpsSvExtInfo*  info = &sv->sv_list[i];
+        int            slot = gps_sv_ext_slot(info->constellation, info->svid);
+
+        info->flags = 0;
+        if (gps_sv_ext_test(sv->used_in_fix_mask, slot))
+            info->flags |= GPS_SV_EXT_USED_IN_FIX;
+    }
+}
+
+
+static void
+nmea_reader_publish( NmeaReader*  r, int  what )
+{
+#if GPS_DEBUG
+    if (what & NMEA_EPOCH_FIX) {
+        char   temp[256];
+        char*  p   = temp;
+        char*  end = p + sizeof(temp);
+        struct tm   utc;
+        time_t      secs = (time_t)(r->fix.timestamp / 1000);
+
+        p += snprintf( p, end-p, "sending fix" );
+        if (r->fix.flags & GPS_LOCATION_HAS_LAT_LONG) {
+            p += snprintf(p, end-p, " lat=%g lon=%g", r->fix.latitude, r->fix.longitude);
+        }
+        if (r->fix.flags & GPS_LOCATION_HAS_ALTITUDE) {
+            p += snprintf(p, end-p, " altitude=%g", r->fix.altitude);
+        }
+        if (r->fix.flags & GPS_LOCATION_HAS_SPEED) {
+            p += snprintf(p, end-p, " speed=%g", r->fix.speed);
+        }
+        if (r->fix.flags & GPS_LOCATION_HAS_BEARING) {
+            p += snprintf(p, end-p, " bearing=%g", r->fix.bearing);
+        }
+        if (r->fix.flags & GPS_LOCATION_HAS_ACCURACY) {
+            p += snprintf(p,end-p, " accuracy=%g", r->fix.accuracy);
+        }
+        gmtime_r( &secs, &utc );
+        p += snprintf(p, end-p, " time=%s", asctime( &utc ) );
+        D("%s", temp);
+    }
+#endif
+    if (what & NMEA_EPOCH_SV)
+        nmea_reader_sv_ext_flags( &r->sv_ext );
+    if (r->callback)
+        r->callback( r->callback_opaque, r, what );
+    else
+        D("no callback, epoch dropped");
+}
+
+
+/* the satellite table, if a GSV cycle completed since it was last
+ * published
+ */
+static void
+nmea_reader_publish_sv( NmeaReader*  r )
+{
+    if (r->sv_status_changed) {
+        r->sv_status_changed = 0;
+        nmea_reader_publish( r, NMEA_EPOCH_SV );
+    }
+}
+
+
+/* GSV cycles that came after the last sentence of the previous epoch are
+ * complete once the next one begins
+ */
+static void
+nmea_reader_epoch_begin( NmeaReader*  r, int  tod )
+{
+    nmea_reader_publish_sv( r );
+    r->fix.flags  = 0;
+    r->epoch_open = 1;
+    r->epoch_tod  = tod;
+    r->epoch_last = 0;
+}
+
+
+static void
+nmea_reader_epoch_close( NmeaReader*  r, int  how )
+{
+    r->epoch_open = 0;
+
+    // an epoch without any valid field (e.g. no fix yet) only reports its end
+    if (r->fix.flags != 0)
+        how |= NMEA_EPOCH_FIX;
+    if (r->sv_status_changed) {
+        r->sv_status_changed = 0;
+        how |= NMEA_EPOCH_SV;
+    }
+    nmea_reader_publish( r, how );
+}
+
+
+/* called before a sentence of the fix epoch is parsed, 'tod' is its time
+ * tag or -1 if it doesn't carry one.
+ */
+static void
+nmea_reader_epoch_enter( NmeaReader*  r, unsigned  id, int  tod )
+{
+    if (r->epoch_open) {
+        if (tod < 0 || r->epoch_tod < 0 || tod == r->epoch_tod) {
+            if (tod >= 0)
+                r->epoch_tod = tod;
+            return;
+        }
+        /* a new time tag while the epoch is still open: it ended without
+         * the sentence we expected, remember which one really was last.
+         */
+        D("epoch ended by a new time tag, last sentence was 0x%06x", r->epoch_last);
+        r->epoch_end = r->epoch_last;
+        nmea_reader_epoch_close( r, NMEA_EPOCH_NEXT );
+        nmea_reader_epoch_begin( r, tod );
+        return;
+    }
+
+    if (tod >= 0 && tod == r->epoch_tod) {
+        /* late sentence of an epoch that was already published, the
+         * burst really ends with this one.
+         */
+        D("late sentence 0x%06x for published epoch", id);
+        r->epoch_end = id;
+        return;
+    }
+    nmea_reader_epoch_begin( r, tod );
+}
+
+
+/* called after a sentence of the fix epoch was parsed */
+static void
+nmea_reader_epoch_leave( NmeaReader*  r, unsigned  id )
+{
+    if (!r->epoch_open)
+        return;
+
+    r->epoch_last = id;
+    if (id == r->epoch_end)
+        nmea_reader_epoch_close( r, NMEA_EPOCH_END );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   R E A D E R                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+void
+nmea_reader_flush( NmeaReader*  r )
+{
+    if (r->epoch_open)
+        nmea_reader_epoch_close( r, NMEA_EPOCH_END );
+}
+
+
+int
+nmea_reader_next_epoch( const NmeaReader*  r, const char*  p, const char*  end )
+{
+    NmeaTokenizer        tzer[1];
+    const NmeaSentence*  sentence;
+    const char*          s = p;
+    Token                tok;
+    int                  tod;
+
+    if (!r->epoch_open || r->epoch_tod < 0 || end - p < 9)
+        return 0;
+
+    /* the same checks as nmea_reader_parse(), up to the time tag */
+    if (s[0] == '$')
+        s += 1;
+    if (s[0] == 'P' || s[5] != ',' || !nmea_talker(s))
+        return 0;
+
+    sentence = nmea_dispatch_find( NMEA_SENTENCE_ID(s[2], s[3], s[4]) );
+    if (sentence == NULL || !sentence->epoch || sentence->time_field < 0)
+        return 0;
+    if (nmea_tokenizer_init_checked(tzer, p, end, r->checksum_mode) < 0)
+        return 0;
+
+    tok = nmea_tokenizer_get(tzer, sentence->time_field);
+    tod = nmea_decode_time(tok.p, tok.end);
+    return (tod >= 0 && tod != r->epoch_tod);
+}
+
+
+void
+nmea_reader_parse( NmeaReader*  r, const char*  p, const char*  end )
+{
+   /* we received a complete sentence, now parse it to generate
+    * a new GPS fix...
+    */
+    NmeaTokenizer        tzer[1];
+    const NmeaSentence*  sentence;
+    const char*          s = p;
+    unsigned             id;
+    int                  talker;
+
+    D("Received: '%.*s'", end-p, p);
+    r->stats.sentences += 1;
+
+    if (end - p < 9) {
+        D("Too short. discarded.");
+        r->stats.malformed += 1;
+        return;
+    }
+
+    /* look at the raw sentence id first, so that proprietary and unknown
+     * sentences are dropped before any tokenizing is done.
+     */
+    if (s[0] == '$')
+        s += 1;
+
+    if (s[0] == 'P' || s[5] != ',') {
+        D("proprietary or malformed sentence '%.*s', ignored", end-p, p);
+        r->stats.ignored += 1;
+        return;
+    }
+
+    talker   = nmea_talker(s);
+    id       = NMEA_SENTENCE_ID(s[2], s[3], s[4]);
+    sentence = talker ? nmea_dispatch_find(id) : NULL;
+    if (sentence == NULL) {
+        D("unknown sentence '%.*s'", 5, s);
+        r->stats.ignored += 1;
+        return;
+    }
+
+    if (nmea_tokenizer_init_checked(tzer, p, end, r->checksum_mode) < 0) {
+        D("checksum error in '%.*s', discarded", end-p, p);
+        r->stats.bad_checksum += 1;
+        return;
+    }
+#if GPS_DEBUG
+    {
+        int  n;
+        D("Found %d tokens", tzer->count);
+        for (n = 0; n < tzer->count; n++) {
+            Token  tok = nmea_tokenizer_get(tzer,n);
+            D("%2d: '%.*s'", n, tok.end-tok.p, tok.p);
+        }
+    }
+#endif
+
+    if (sentence->epoch) {
+        int  tod = -1;
+
+        if (sentence->time_field >= 0) {
+            Token  tok = nmea_tokenizer_get(tzer, sentence->time_field);
+            tod = nmea_decode_time(tok.p, tok.end);
+        }
+        nmea_reader_epoch_enter( r, id, tod );
+    }
+
+    r->talker = talker;
+    sentence->func( r, tzer );
+    r->last_sentence = id;
+
+    if (sentence->epoch)
+        nmea_reader_epoch_leave( r, id );
+}
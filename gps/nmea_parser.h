@@ -0,0 +1,202 @@
+#ifndef _nmea_parser_h
+#define _nmea_parser_h
+
+#include <hardware_legacy/gps.h>
+#include <hardware_legacy/gps_sv_ext.h>
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   T O K E N I Z E R                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* a token is a span inside the sentence being parsed, nothing is copied */
+typedef struct {
+    const char*  p;
+    const char*  end;
+} Token;
+
+#define  MAX_NMEA_TOKENS  32
+
+typedef struct {
+    int     count;
+    Token   tokens[ MAX_NMEA_TOKENS ];
+} NmeaTokenizer;
+
+/* how nmea_tokenizer_init_checked() deals with the '*hh' checksum */
+enum {
+    NMEA_CHECKSUM_IGNORE  = 0,      /* strip it without looking at it */
+    NMEA_CHECKSUM_VERIFY  = 1,      /* reject sentences with a wrong checksum */
+    NMEA_CHECKSUM_REQUIRE = 2,      /* also reject sentences without one */
+};
+
+/* split a sentence into fields. the checksum is computed in the same
+ * pass, returns the number of tokens or -1 if the sentence is rejected.
+ */
+extern int
+nmea_tokenizer_init_checked( NmeaTokenizer*  t, const char*  p, const char*  end, int  mode );
+
+extern int
+nmea_tokenizer_init( NmeaTokenizer*  t, const char*  p, const char*  end );
+
+/* returns an empty token for out-of-range indices */
+extern Token
+nmea_tokenizer_get( NmeaTokenizer*  t, int  index );
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   D E C I M A L S                       *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* a decimal field, as a scaled integer: value = mant / 10^frac */
+typedef struct {
+    long long  mant;
+    int        frac;
+} NmeaDecimal;
+
+/* at most this many fraction digits are kept, extra ones are truncated */
+#define  NMEA_DECIMAL_MAX_FRAC  9
+
+/* decode '[+-]ddd[.ddd]' without going through strtod() or the locale.
+ * returns 0 on success, -1 if the field is empty or malformed.
+ */
+extern int
+nmea_decimal_decode( const char*  p, const char*  end, NmeaDecimal*  d );
+
+/* the conversion is exact for the fixed-precision fields NMEA uses */
+extern double
+nmea_decimal_to_double( const NmeaDecimal*  d );
+
+/* decode a 'dddmm.mmmm' coordinate into degrees, -1. if malformed */
+extern double
+nmea_decode_coord( const char*  p, const char*  end );
+
+/* decode a 'hhmmss.sss' time into milliseconds since midnight, -1 if
+ * malformed. fractions below the millisecond are truncated.
+ */
+extern int
+nmea_decode_time( const char*  p, const char*  end );
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       N M E A   P A R S E R                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* sentence ids packed in an integer, e.g. NMEA_SENTENCE_ID('G','G','A') */
+#define  NMEA_SENTENCE_ID(a,b,c)  (((unsigned)(a) << 16) | ((b) << 8) | (c))
+
+/* talkers understood by the parser, as bits so they can be combined */
+enum {
+    NMEA_TALKER_GP = (1 << 0),      /* GPS */
+    NMEA_TALKER_GL = (1 << 1),      /* GLONASS */
+    NMEA_TALKER_GA = (1 << 2),      /* Galileo */
+    NMEA_TALKER_GN = (1 << 3),      /* combined GNSS solution */
+    NMEA_TALKER_BD = (1 << 4),      /* BeiDou, also sent as 'GB' */
+};
+
+/* sentence counters, for diagnostics */
+typedef struct {
+    unsigned  sentences;        /* sentences handed to the parser */
+    unsigned  malformed;        /* too short to be a sentence */
+    unsigned  ignored;          /* proprietary, unknown talker or type */
+    unsigned  bad_checksum;     /* rejected by the checksum check */
+} NmeaStats;
+
+/* what an epoch publication carries, see nmea_reader_set_callback() */
+enum {
+    NMEA_EPOCH_FIX = (1 << 0),      /* r->fix holds a complete epoch */
+    NMEA_EPOCH_SV  = (1 << 1),      /* r->sv_status holds a complete GSV cycle */
+    NMEA_EPOCH_END = (1 << 2),      /* the current sentence ended the epoch */
+    NMEA_EPOCH_NEXT = (1 << 3),     /* the epoch ended before the current sentence */
+};
+
+struct NmeaReader;
+
+typedef void (*nmea_epoch_func)( void*  opaque, struct NmeaReader*  r, int  what );
+
+typedef struct NmeaReader {
+    int     utc_year;
+    int     utc_mon;
+    int     utc_day;
+    int     utc_tod;            /* time of day of the last sentence, in ms */
+    GpsUtcTime  day_epoch;      /* UTC epoch of utc_year/mon/day, in ms */
+    GpsLocation  fix;           /* fields of the epoch being assembled */
+    GpsSvStatus  sv_status;     /* GPS_MAX_SVS satellites, GPS PRNs in the masks */
+    GpsSvExtStatus  sv_ext;     /* the same cycle, all constellations */
+    int     sv_status_changed;
+    int     epoch_open;         /* an epoch is being assembled */
+    int     epoch_tod;          /* its UTC time tag, -1 until one is seen */
+    unsigned epoch_last;        /* id of its last sentence so far */
+    unsigned epoch_end;         /* id of the sentence that ends an epoch */
+    int     talker;             /* talker of the sentence being parsed */
+    unsigned last_sentence;     /* id of the previous sentence */
+    int     gsv_talkers;        /* talkers that contributed to sv_status */
+    int     gsv_count;          /* satellites seen in the current GSV cycle */
+    int     checksum_mode;
+    NmeaStats  stats;
+    nmea_epoch_func  callback;
+    void*            callback_opaque;
+} NmeaReader;
+
+extern void
+nmea_reader_init( NmeaReader*  r );
+
+/* one of NMEA_CHECKSUM_XXX, the default is NMEA_CHECKSUM_IGNORE */
+extern void
+nmea_reader_set_checksum_mode( NmeaReader*  r, int  mode );
+
+/* sentences carrying the same UTC time are assembled into one epoch, which
+ * is published to the callback with NMEA_EPOCH_FIX exactly once, right
+ * after its last sentence. the last sentence of a burst is learned from
+ * the receiver's output; until then, and whenever the receiver changes its
+ * pattern, an epoch is published when the next time tag shows up.
+ * r->fix.flags only reflect what the epoch actually contained.
+ *
+ * the end of every epoch is reported with NMEA_EPOCH_END or NMEA_EPOCH_NEXT,
+ * which tell whether the sentence being parsed belongs to it, even when the
+ * epoch had no fix to publish.
+ *
+ * satellite status is published with NMEA_EPOCH_SV once per epoch, in both
+ * r->sv_status and r->sv_ext, after the GSV cycles of every talker: with
+ * the epoch, or when the next one begins if they come after its last
+ * sentence. r->fix, r->sv_status and
+ * r->sv_ext may only be read during the call.
+ */
+extern void
+nmea_reader_set_callback( NmeaReader*  r, nmea_epoch_func  func, void*  opaque );
+
+/* the constellation of a satellite as numbered in GSA and GSV sentences of
+ * 'talker', one of NMEA_TALKER_XXX, and its id within that constellation.
+ * returns GPS_CONSTELLATION_UNKNOWN if the number makes no sense.
+ */
+extern int
+nmea_sv_constellation( int  talker, int  prn, int*  svid );
+
+/* parse one sentence, as delivered by the NMEA framer */
+extern void
+nmea_reader_parse( NmeaReader*  r, const char*  p, const char*  end );
+
+/* publish the epoch being assembled, if any, without waiting for its last
+ * sentence or the next time tag. for sources that don't send regular
+ * bursts, such as one-shot fixes of the emulator. it is reported with
+ * NMEA_EPOCH_END.
+ */
+extern void
+nmea_reader_flush( NmeaReader*  r );
+
+/* returns 1 if parsing 'p'..'end' would end the epoch being assembled with
+ * NMEA_EPOCH_NEXT, 0 otherwise. the reader isn't changed. for sources that
+ * pace their input, so that they can wait before such a sentence.
+ */
+extern int
+nmea_reader_next_epoch( const NmeaReader*  r, const char*  p, const char*  end );
+
+#endif /* _nmea_parser_h */
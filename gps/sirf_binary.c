@@ -0,0 +1,303 @@
+#include <string.h>
+
+#define  LOG_TAG  "gps_sirf"
+#include <cutils/log.h>
+
+#include "sirf_binary.h"
+
+#define  GPS_DEBUG  0
+
+#if GPS_DEBUG
+#  define  D(...)   LOGD(__VA_ARGS__)
+#else
+#  define  D(...)   ((void)0)
+#endif
+
+/* reader states, where we are in the frame */
+enum {
+    SIRF_SYNC1 = 0,
+    SIRF_SYNC2,
+    SIRF_LEN1,
+    SIRF_LEN2,
+    SIRF_PAYLOAD,
+    SIRF_SUM1,
+    SIRF_SUM2,
+    SIRF_END1,
+    SIRF_END2
+};
+
+#define  SIRF_GEODETIC_SIZE  91
+#define  SIRF_TRACKER_HEADER  8
+#define  SIRF_TRACKER_CHANNEL 15
+
+/* tracker channel state bits */
+#define  SIRF_TRACK_EPHEMERIS  0x80
+
+static unsigned
+get_u16( const unsigned char*  p )
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get_u32( const unsigned char*  p )
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int32_t
+get_s32( const unsigned char*  p )
+{
+    return (int32_t)get_u32(p);
+}
+
+
+/* days since 1970-01-01 for a proleptic gregorian date */
+static long
+sirf_days_from_civil( int  y, int  m, int  d )
+{
+    long  era, yoe, doy, doe;
+
+    y  -= (m <= 2);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       M E S S A G E S                                 *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* MID 41: the fix, in fixed-point fields that need no parsing */
+static void
+sirf_reader_geodetic( SirfReader*  r, const unsigned char*  p, int  len )
+{
+    GpsLocation*  fix = &r->fix;
+    int           year, mon, day;
+
+    if (len < SIRF_GEODETIC_SIZE) {
+        r->stats.bad_length += 1;
+        return;
+    }
+
+    r->used_mask  = get_u32(p + 19);
+    r->used_count = p[88];
+
+    /* non-zero 'nav valid' bits explain why there is no fix */
+    if (get_u16(p + 1) != 0)
+        return;
+
+    year = get_u16(p + 11);
+    mon  = p[13];
+    day  = p[14];
+
+    fix->flags     = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ALTITUDE |
+                     GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING |
+                     GPS_LOCATION_HAS_ACCURACY;
+    fix->latitude  = get_s32(p + 23) / 1e7;
+    fix->longitude = get_s32(p + 27) / 1e7;
+    fix->altitude  = get_s32(p + 35) / 100.;        /* above MSL, as GGA */
+    fix->speed     = get_u16(p + 40) / 100.f;
+    fix->bearing   = get_u16(p + 42) / 100.f;
+    fix->accuracy  = get_u32(p + 50) / 100.f;      /* estimated horizontal error */
+    fix->timestamp = (GpsUtcTime) sirf_days_from_civil(year, mon, day) * 86400000LL +
+                     (p[15] * 3600 + p[16] * 60) * 1000LL + get_u16(p + 17);
+
+    if (r->callback)
+        r->callback( r->callback_opaque, r, SIRF_EPOCH_FIX );
+}
+
+
+/* MID 4: what each channel is tracking */
+static void
+sirf_reader_tracker( SirfReader*  r, const unsigned char*  p, int  len )
+{
+    GpsSvStatus*  sv = &r->sv_status;
+    int           channels = p[7];
+    int           ch;
+
+    if (len < SIRF_TRACKER_HEADER + channels * SIRF_TRACKER_CHANNEL) {
+        r->stats.bad_length += 1;
+        return;
+    }
+
+    sv->num_svs        = 0;
+    sv->ephemeris_mask = 0;
+    for (ch = 0; ch < channels && sv->num_svs < GPS_MAX_SVS; ch++) {
+        const unsigned char*  c   = p + SIRF_TRACKER_HEADER + ch * SIRF_TRACKER_CHANNEL;
+        GpsSvInfo*            info = &sv->sv_list[sv->num_svs];
+        int                   prn = c[0];
+        int                   cn0 = 0, i;
+
+        if (prn == 0)
+            continue;
+
+        /* ten C/N0 samples, one per 100 ms */
+        for (i = 0; i < 10; i++)
+            cn0 += c[5 + i];
+
+        info->prn       = prn;
+        info->azimuth   = c[1] * 1.5f;
+        info->elevation = c[2] * 0.5f;
+        info->snr       = cn0 / 10.f;
+        if ((get_u16(c + 3) & SIRF_TRACK_EPHEMERIS) && prn <= 32)
+            sv->ephemeris_mask |= 1u << (prn - 1);
+        sv->num_svs += 1;
+    }
+    sv->used_in_fix_mask = r->used_mask;
+    sv->num_used_svs     = r->used_count;
+
+    if (r->callback)
+        r->callback( r->callback_opaque, r, SIRF_EPOCH_SV );
+}
+
+
+static void
+sirf_reader_message( SirfReader*  r )
+{
+    r->stats.frames += 1;
+
+    switch (r->payload[0]) {
+        case SIRF_MID_GEODETIC:
+            sirf_reader_geodetic( r, r->payload, r->len );
+            break;
+        case SIRF_MID_TRACKER:
+            sirf_reader_tracker( r, r->payload, r->len );
+            break;
+        default:
+            r->stats.ignored += 1;
+    }
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       F R A M I N G                                   *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+void
+sirf_reader_init( SirfReader*  r )
+{
+    memset( r, 0, sizeof(*r) );
+    r->state = SIRF_SYNC1;
+}
+
+
+void
+sirf_reader_set_callback( SirfReader*  r, sirf_epoch_func  func, void*  opaque )
+{
+    r->callback        = func;
+    r->callback_opaque = opaque;
+}
+
+
+void
+sirf_reader_feed( SirfReader*  r, const char*  buf, int  len )
+{
+    const unsigned char*  p   = (const unsigned char*) buf;
+    const unsigned char*  end = p + len;
+
+    while (p < end) {
+        int  c;
+
+        /* the payload is copied in one go */
+        if (r->state == SIRF_PAYLOAD) {
+            int  n = r->len - r->pos;
+            int  i;
+
+            if (n > end - p)
+                n = end - p;
+            memcpy( r->payload + r->pos, p, n );
+            for (i = 0; i < n; i++)
+                r->sum += p[i];
+            r->pos += n;
+            p      += n;
+            if (r->pos == r->len)
+                r->state = SIRF_SUM1;
+            continue;
+        }
+
+        c = *p++;
+        switch (r->state) {
+            case SIRF_SYNC1:
+                if (c == 0xA0)
+                    r->state = SIRF_SYNC2;
+                break;
+            case SIRF_SYNC2:
+                r->state = (c == 0xA2) ? SIRF_LEN1 : (c == 0xA0) ? SIRF_SYNC2 : SIRF_SYNC1;
+                break;
+            case SIRF_LEN1:
+                r->len   = c << 8;
+                r->state = SIRF_LEN2;
+                break;
+            case SIRF_LEN2:
+                r->len |= c;
+                if (r->len == 0 || r->len > SIRF_MAX_PAYLOAD) {
+                    r->stats.bad_length += 1;
+                    r->state = SIRF_SYNC1;
+                    break;
+                }
+                r->pos   = 0;
+                r->sum   = 0;
+                r->state = SIRF_PAYLOAD;
+                break;
+            case SIRF_SUM1:
+                r->checksum = c << 8;
+                r->state    = SIRF_SUM2;
+                break;
+            case SIRF_SUM2:
+                r->checksum |= c;
+                r->state = SIRF_END1;
+                break;
+            case SIRF_END1:
+                r->state = (c == 0xB0) ? SIRF_END2 : SIRF_SYNC1;
+                break;
+            case SIRF_END2:
+                r->state = SIRF_SYNC1;
+                if (c != 0xB3)
+                    break;
+                if (r->checksum != (r->sum & 0x7FFF)) {
+                    D("bad checksum for message %d", r->payload[0]);
+                    r->stats.bad_checksum += 1;
+                    break;
+                }
+                sirf_reader_message( r );
+                break;
+        }
+    }
+}
+
+
+int
+sirf_encode( unsigned char*  out, int  max, const unsigned char*  payload, int  len )
+{
+    unsigned  sum = 0;
+    int       i;
+
+    if (len + SIRF_FRAME_OVERHEAD > max || len > SIRF_MAX_PAYLOAD)
+        return -1;
+
+    for (i = 0; i < len; i++)
+        sum += payload[i];
+    sum &= 0x7FFF;
+
+    out[0] = 0xA0;
+    out[1] = 0xA2;
+    out[2] = len >> 8;
+    out[3] = len & 0xFF;
+    memcpy( out + 4, payload, len );
+    out[len + 4] = sum >> 8;
+    out[len + 5] = sum & 0xFF;
+    out[len + 6] = 0xB0;
+    out[len + 7] = 0xB3;
+    return len + SIRF_FRAME_OVERHEAD;
+}
@@ -0,0 +1,80 @@
+#ifndef _sirf_binary_h
+#define _sirf_binary_h
+
+#include <stdint.h>
+#include <hardware_legacy/gps.h>
+
+/* the SiRF binary protocol. messages are framed as
+ *
+ *   A0 A2, u16 payload length, payload, u16 checksum, B0 B3
+ *
+ * the checksum is the 15-bit sum of the payload bytes, the first payload
+ * byte is the message id. all integers are big-endian.
+ */
+#define  SIRF_MAX_PAYLOAD  1023
+
+/* size of a frame around a payload */
+#define  SIRF_FRAME_OVERHEAD  8
+
+/* message ids */
+enum {
+    SIRF_MID_TRACKER       = 4,     /* measured tracker data, once per second */
+    SIRF_MID_GEODETIC      = 41,    /* geodetic navigation data, once per fix */
+    SIRF_MID_INIT          = 128,   /* input: position and time to start from */
+    SIRF_MID_SWITCH_NMEA   = 129,   /* input: back to NMEA, with per-sentence rates */
+    SIRF_MID_SET_RATE      = 166,   /* input: output rate of a message */
+};
+
+/* what an epoch publication carries, see sirf_reader_set_callback() */
+enum {
+    SIRF_EPOCH_FIX = (1 << 0),      /* r->fix holds a new fix */
+    SIRF_EPOCH_SV  = (1 << 1),      /* r->sv_status holds new tracking data */
+};
+
+typedef struct {
+    unsigned  frames;           /* valid frames */
+    unsigned  bad_checksum;
+    unsigned  bad_length;       /* too long, or too short for their id */
+    unsigned  ignored;          /* message ids nobody needs */
+} SirfStats;
+
+struct SirfReader;
+
+typedef void (*sirf_epoch_func)( void*  opaque, struct SirfReader*  r, int  what );
+
+typedef struct SirfReader {
+    int              state;         /* position in the frame */
+    int              len;           /* payload length of the current frame */
+    int              pos;
+    unsigned         sum;
+    unsigned         checksum;
+    GpsLocation      fix;
+    GpsSvStatus      sv_status;
+    uint32_t         used_mask;     /* from the last geodetic message */
+    int              used_count;
+    SirfStats        stats;
+    sirf_epoch_func  callback;
+    void*            callback_opaque;
+    unsigned char    payload[ SIRF_MAX_PAYLOAD ];
+} SirfReader;
+
+extern void
+sirf_reader_init( SirfReader*  r );
+
+/* r->fix and r->sv_status may only be read during the call */
+extern void
+sirf_reader_set_callback( SirfReader*  r, sirf_epoch_func  func, void*  opaque );
+
+/* decode a chunk of bytes read from the receiver. frames that straddle
+ * two chunks are reassembled, bytes outside of valid frames are skipped.
+ */
+extern void
+sirf_reader_feed( SirfReader*  r, const char*  buf, int  len );
+
+/* frame 'payload' for sending, returns the frame length or -1 if it
+ * doesn't fit in 'max' bytes
+ */
+extern int
+sirf_encode( unsigned char*  out, int  max, const unsigned char*  payload, int  len );
+
+#endif /* _sirf_binary_h */
@@ -324,6 +324,12 @@ const GpsInterface* gps_get_hardware_interface();
  */
 const GpsInterface* gps_get_qemu_interface();
 
+/**
+ * Returns the GPS interface replaying the file named by the
+ * "gps.replay.file" property, or NULL when it isn't set.
+ */
+const GpsInterface* gps_get_replay_interface();
+
 /**
  * Returns the default GPS interface.
  */
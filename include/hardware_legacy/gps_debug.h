@@ -0,0 +1,33 @@
+#ifndef _HARDWARE_GPS_DEBUG_H
+#define _HARDWARE_GPS_DEBUG_H
+
+#if __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Name for the debug interface, returned by get_extension() when the HAL
+ * keeps timing metrics.
+ */
+#define GPS_DEBUG_INTERFACE "gps-debug"
+
+/** Extended interface for diagnostics. */
+typedef struct {
+    /**
+     * Writes a text report to buf: time to first fix per session, delay
+     * from the receiver's output to location_cb returning, parse and
+     * callback times, as histograms in microseconds, followed by the
+     * HAL's counters. buf is always NUL-terminated. Returns the length of
+     * the whole report, which is more than len - 1 if it was cut short.
+     */
+    int   (*dump)( char* buf, int len );
+
+    /** Clears the histograms. */
+    void  (*reset)( void );
+} GpsDebugInterface;
+
+#if __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // _HARDWARE_GPS_DEBUG_H
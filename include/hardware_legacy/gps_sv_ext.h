@@ -0,0 +1,190 @@
+#ifndef _HARDWARE_GPS_SV_EXT_H
+#define _HARDWARE_GPS_SV_EXT_H
+
+#include <stdint.h>
+
+#if __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Name for the extended satellite status interface. Unlike GpsSvStatus it
+ * isn't limited to 32 GPS PRNs: satellites of every constellation the
+ * receiver tracks are reported.
+ */
+#define GPS_SV_EXT_INTERFACE "gps-sv-ext"
+
+/** Constellations, as GpsSvExtInfo.constellation. */
+#define GPS_CONSTELLATION_UNKNOWN   0
+#define GPS_CONSTELLATION_GPS       1
+#define GPS_CONSTELLATION_SBAS      2
+#define GPS_CONSTELLATION_GLONASS   3
+#define GPS_CONSTELLATION_QZSS      4
+#define GPS_CONSTELLATION_BEIDOU    5
+#define GPS_CONSTELLATION_GALILEO   6
+#define GPS_CONSTELLATION_COUNT     7
+
+/**
+ * Each satellite has a fixed slot in the bitsets of GpsSvExtStatus, given
+ * by gps_sv_ext_slot(). The slots of a constellation are contiguous, in
+ * order of svid:
+ *
+ *   GPS        svid 1-32       slots 0-31
+ *   SBAS       svid 120-158    slots 32-70
+ *   GLONASS    svid 1-32       slots 71-102    (orbital slot number)
+ *   QZSS       svid 193-202    slots 103-112
+ *   BeiDou     svid 1-63       slots 113-175
+ *   Galileo    svid 1-36       slots 176-211
+ */
+#define GPS_SV_EXT_SLOTS        212
+
+/** 32-bit words in each bitset. */
+#define GPS_SV_EXT_MASK_WORDS   ((GPS_SV_EXT_SLOTS + 31) / 32)
+
+/** Maximum number of satellites in GpsSvExtStatus.sv_list. */
+#define GPS_SV_EXT_MAX_SVS      64
+
+/** GpsSvExtInfo flags. */
+#define GPS_SV_EXT_USED_IN_FIX      0x01
+#define GPS_SV_EXT_HAS_EPHEMERIS    0x02
+#define GPS_SV_EXT_HAS_ALMANAC      0x04
+
+/** Represents one satellite, 16 bytes. */
+typedef struct {
+    /** One of GPS_CONSTELLATION_XXX. */
+    uint8_t     constellation;
+    /** GPS_SV_EXT_XXX bits. */
+    uint8_t     flags;
+    /** Identifier within the constellation, see gps_sv_ext_slot(). */
+    int16_t     svid;
+    /** Signal to noise ratio, in dB-Hz. */
+    float       snr;
+    /** Elevation in degrees. */
+    float       elevation;
+    /** Azimuth in degrees. */
+    float       azimuth;
+} GpsSvExtInfo;
+
+/** Represents the status of all tracked satellites. */
+typedef struct {
+    /** Number of satellites in sv_list. */
+    int             num_svs;
+    /** Number of satellites used in the most recent fix. */
+    int             num_used_svs;
+    /** Bitsets indexed by slot, bit (slot % 32) of word (slot / 32). */
+    uint32_t        used_in_fix_mask[GPS_SV_EXT_MASK_WORDS];
+    uint32_t        ephemeris_mask[GPS_SV_EXT_MASK_WORDS];
+    uint32_t        almanac_mask[GPS_SV_EXT_MASK_WORDS];
+    GpsSvExtInfo    sv_list[GPS_SV_EXT_MAX_SVS];
+} GpsSvExtStatus;
+
+/**
+ * Returns the slot of a satellite, or -1 if the constellation or svid is
+ * out of range.
+ */
+static inline int gps_sv_ext_slot(int constellation, int svid)
+{
+    /* first svid, number of svids and first slot of each constellation */
+    static const int16_t layout[GPS_CONSTELLATION_COUNT][3] = {
+        {   0,  0,   0 },   /* unknown */
+        {   1, 32,   0 },   /* GPS */
+        { 120, 39,  32 },   /* SBAS */
+        {   1, 32,  71 },   /* GLONASS */
+        { 193, 10, 103 },   /* QZSS */
+        {   1, 63, 113 },   /* BeiDou */
+        {   1, 36, 176 },   /* Galileo */
+    };
+    int  n;
+
+    if (constellation <= 0 || constellation >= GPS_CONSTELLATION_COUNT)
+        return -1;
+    n = svid - layout[constellation][0];
+    if (n < 0 || n >= layout[constellation][1])
+        return -1;
+    return layout[constellation][2] + n;
+}
+
+/** Tests the bit of a slot in one of the bitsets. */
+static inline int gps_sv_ext_test(const uint32_t* mask, int slot)
+{
+    return (mask[slot >> 5] >> (slot & 31)) & 1;
+}
+
+/** Sets the bit of a slot in one of the bitsets. */
+static inline void gps_sv_ext_set(uint32_t* mask, int slot)
+{
+    mask[slot >> 5] |= 1u << (slot & 31);
+}
+
+/** Callback with extended satellite status. */
+typedef void (* gps_sv_ext_status_callback)(GpsSvExtStatus* sv_status);
+
+/** Callback structure for the extended satellite status interface. */
+typedef struct {
+        gps_sv_ext_status_callback sv_ext_status_cb;
+} GpsSvExtCallbacks;
+
+/** Extended interface for multi-constellation satellite status. */
+typedef struct {
+    /**
+     * Provides the callback, called alongside sv_status_cb with the same
+     * satellites and more. Passing NULL stops the reports.
+     */
+    int  (*init)( GpsSvExtCallbacks* callbacks );
+} GpsSvExtInterface;
+
+/**
+ * Name for the satellite delta interface, which only reports the
+ * satellites that changed noticeably since the previous report.
+ */
+#define GPS_SV_DELTA_INTERFACE "gps-sv-delta"
+
+/** In GpsSvDelta.changes, the satellite is no longer tracked. */
+#define GPS_SV_EXT_REMOVED          0x80
+
+/** Represents the changes to the satellite table. */
+typedef struct {
+    /**
+     * Non-zero when changes holds the whole table, which replaces the
+     * previous one. The first report of a session is always a reset, as is
+     * any report following a lost one.
+     */
+    int             reset;
+    /** Number of satellites tracked after the changes. */
+    int             num_svs;
+    /** Number of satellites used in the most recent fix. */
+    int             num_used_svs;
+    /** Number of entries in changes. */
+    int             num_changes;
+    /**
+     * Satellites that appeared, or whose snr, elevation, azimuth or flags
+     * changed past the HAL's thresholds, and satellites that disappeared,
+     * flagged GPS_SV_EXT_REMOVED. Small changes are held back until they
+     * add up, so the values may lag by less than a threshold.
+     */
+    GpsSvExtInfo    changes[GPS_SV_EXT_MAX_SVS];
+} GpsSvDelta;
+
+/** Callback with satellite changes. */
+typedef void (* gps_sv_delta_callback)(GpsSvDelta* delta);
+
+/** Callback structure for the satellite delta interface. */
+typedef struct {
+        gps_sv_delta_callback sv_delta_cb;
+} GpsSvDeltaCallbacks;
+
+/** Extended interface for incremental satellite status. */
+typedef struct {
+    /**
+     * Provides the callback, called for each satellite report that has
+     * changes. sv_status_cb still gets the whole table for the same
+     * reports. Passing NULL stops the reports.
+     */
+    int  (*init)( GpsSvDeltaCallbacks* callbacks );
+} GpsSvDeltaInterface;
+
+#if __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // _HARDWARE_GPS_SV_EXT_H
@@ -0,0 +1,32 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+# Micro-benchmark of the NMEA framer and parser, built from the same
+# sources as the GPS backends. The allocator is wrapped so that the report
+# can count allocations made on the parsing path.
+
+LOCAL_SRC_FILES:= \
+	nmeabench.c \
+	corpus.c \
+	../../gps/nmea_framer.c \
+	../../gps/nmea_parser.c
+
+LOCAL_CFLAGS:= -O2
+
+LOCAL_C_INCLUDES:= \
+	$(LOCAL_PATH)/../../gps
+
+LOCAL_LDFLAGS:= \
+	-Wl,--wrap=malloc \
+	-Wl,--wrap=calloc \
+	-Wl,--wrap=realloc
+
+LOCAL_SHARED_LIBRARIES:= liblog
+
+LOCAL_MODULE:= nmeabench
+
+LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
+
+LOCAL_MODULE_TAGS:= tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,527 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "corpus.h"
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       B U F F E R                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static int
+corpus_reserve( Corpus*  c, int  len )
+{
+    if (c->len + len > c->max) {
+        int    max  = (c->max ? c->max*2 : 65536) + len;
+        char*  data = realloc( c->data, max );
+        if (data == NULL)
+            return -1;
+        c->data = data;
+        c->max  = max;
+    }
+    return 0;
+}
+
+
+static void
+corpus_raw( Corpus*  c, const char*  p, int  len )
+{
+    if (corpus_reserve( c, len ) == 0) {
+        memcpy( c->data + c->len, p, len );
+        c->len += len;
+    }
+}
+
+
+/* append '$<body>*hh<CR><LF>' */
+static void
+corpus_sentence( Corpus*  c, const char*  format, ... )
+{
+    char     line[256];
+    va_list  args;
+    int      len, n;
+    unsigned sum = 0;
+
+    va_start( args, format );
+    len = vsnprintf( line+1, sizeof(line)-6, format, args );
+    va_end( args );
+    if (len < 0 || len >= (int)sizeof(line)-6)
+        return;
+
+    for (n = 1; n <= len; n++)
+        sum ^= (unsigned char)line[n];
+
+    line[0] = '$';
+    len += 1;
+    len += snprintf( line+len, sizeof(line)-len, "*%02X\r\n", sum );
+    corpus_raw( c, line, len );
+}
+
+
+/* record where each line starts */
+static int
+corpus_index( Corpus*  c )
+{
+    int  pos = 0;
+
+    c->count = 0;
+    while (pos < c->len) {
+        char*  nl = memchr( c->data + pos, '\n', c->len - pos );
+
+        if (c->count == c->lines_max) {
+            int   max   = c->lines_max ? c->lines_max*2 : 4096;
+            int*  lines = realloc( c->lines, max*sizeof(int) );
+            if (lines == NULL)
+                return -1;
+            c->lines     = lines;
+            c->lines_max = max;
+        }
+        c->lines[c->count++] = pos;
+        pos = nl ? nl + 1 - c->data : c->len;
+    }
+    return 0;
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       R E C E I V E R   M O D E L                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+typedef struct {
+    int  prn;
+    int  elevation;
+    int  azimuth;
+    int  snr;
+} Sv;
+
+typedef struct {
+    unsigned  seed;
+    int       tod;              /* seconds since midnight */
+    double    lat, lon, alt;
+    double    speed;            /* knots */
+    double    course;
+    int       fix;
+} Receiver;
+
+static int
+rnd( Receiver*  rx, int  n )
+{
+    rx->seed = rx->seed * 1103515245 + 12345;
+    return (rx->seed >> 16) % n;
+}
+
+
+static void
+receiver_init( Receiver*  rx, unsigned  seed )
+{
+    memset( rx, 0, sizeof(*rx) );
+    rx->seed = seed;
+    rx->tod  = 12*3600;
+    rx->lat  = 48.1173;
+    rx->lon  = 11.5167;
+    rx->alt  = 545.4;
+    rx->fix  = 1;
+}
+
+
+/* move along 'course' at 'speed' for one second */
+static void
+receiver_move( Receiver*  rx )
+{
+    double  meters = rx->speed * 1852. / 3600.;
+    double  rad    = rx->course * M_PI / 180.;
+
+    rx->lat += meters * cos(rad) / 111120.;
+    rx->lon += meters * sin(rad) / (111120. * cos(rx->lat * M_PI / 180.));
+    rx->tod  = (rx->tod + 1) % (24*3600);
+}
+
+
+static void
+format_time( char*  buf, int  tod )
+{
+    sprintf( buf, "%02d%02d%02d.00", tod / 3600, (tod / 60) % 60, tod % 60 );
+}
+
+
+/* 'ddmm.mmmm,H' or 'dddmm.mmmm,H' */
+static void
+format_coord( char*  buf, double  deg, int  digits, char  pos, char  neg )
+{
+    char    hemi = deg < 0 ? neg : pos;
+    int     d;
+    double  m;
+
+    deg = fabs(deg);
+    d   = (int)deg;
+    m   = (deg - d) * 60.;
+    sprintf( buf, "%0*d%07.4f,%c", digits, d, m, hemi );
+}
+
+
+static void
+emit_gga( Corpus*  c, const char*  talker, Receiver*  rx, int  used )
+{
+    char  t[24], lat[32], lon[32];
+
+    format_time( t, rx->tod );
+    if (!rx->fix) {
+        corpus_sentence( c, "%sGGA,%s,,,,,0,%02d,,,,,,,", talker, t, used );
+        return;
+    }
+    format_coord( lat, rx->lat, 2, 'N', 'S' );
+    format_coord( lon, rx->lon, 3, 'E', 'W' );
+    corpus_sentence( c, "%sGGA,%s,%s,%s,1,%02d,%.1f,%.1f,M,46.9,M,,",
+                     talker, t, lat, lon, used, 0.8 + rnd(rx, 12) / 10., rx->alt );
+}
+
+
+static void
+emit_gll( Corpus*  c, const char*  talker, Receiver*  rx )
+{
+    char  t[24], lat[32], lon[32];
+
+    format_time( t, rx->tod );
+    if (!rx->fix) {
+        corpus_sentence( c, "%sGLL,,,,,%s,V,N", talker, t );
+        return;
+    }
+    format_coord( lat, rx->lat, 2, 'N', 'S' );
+    format_coord( lon, rx->lon, 3, 'E', 'W' );
+    corpus_sentence( c, "%sGLL,%s,%s,%s,A,A", talker, lat, lon, t );
+}
+
+
+static void
+emit_rmc( Corpus*  c, const char*  talker, Receiver*  rx )
+{
+    char  t[24], lat[32], lon[32];
+
+    format_time( t, rx->tod );
+    if (!rx->fix) {
+        corpus_sentence( c, "%sRMC,%s,V,,,,,,,230394,,,N", talker, t );
+        return;
+    }
+    format_coord( lat, rx->lat, 2, 'N', 'S' );
+    format_coord( lon, rx->lon, 3, 'E', 'W' );
+    corpus_sentence( c, "%sRMC,%s,A,%s,%s,%05.1f,%05.1f,230394,003.1,W,A",
+                     talker, t, lat, lon, rx->speed, rx->course );
+}
+
+
+static void
+emit_vtg( Corpus*  c, const char*  talker, Receiver*  rx )
+{
+    if (!rx->fix) {
+        corpus_sentence( c, "%sVTG,,T,,M,,N,,K,N", talker );
+        return;
+    }
+    corpus_sentence( c, "%sVTG,%05.1f,T,,M,%05.1f,N,%05.1f,K,A",
+                     talker, rx->course, rx->speed, rx->speed * 1.852 );
+}
+
+
+static void
+emit_zda( Corpus*  c, const char*  talker, Receiver*  rx )
+{
+    char  t[24];
+
+    format_time( t, rx->tod );
+    corpus_sentence( c, "%sZDA,%s,23,03,1994,00,00", talker, t );
+}
+
+
+static void
+emit_gsa( Corpus*  c, const char*  talker, Receiver*  rx, const Sv*  svs, int  n )
+{
+    char  body[128];
+    int   len, i;
+
+    len = sprintf( body, "%sGSA,A,%d", talker, rx->fix ? 3 : 1 );
+    for (i = 0; i < 12; i++) {
+        if (rx->fix && i < n)
+            len += sprintf( body+len, ",%02d", svs[i].prn );
+        else
+            body[len++] = ',';
+    }
+    if (rx->fix)
+        sprintf( body+len, ",%.1f,%.1f,%.1f",
+                 1.5 + rnd(rx, 20) / 10., 0.8 + rnd(rx, 12) / 10., 1.2 + rnd(rx, 15) / 10. );
+    else
+        sprintf( body+len, ",,," );
+    corpus_sentence( c, "%s", body );
+}
+
+
+static void
+emit_gsv( Corpus*  c, const char*  talker, Receiver*  rx, const Sv*  svs, int  n )
+{
+    int  total = (n + 3) / 4;
+    int  s, i;
+
+    if (n == 0) {
+        corpus_sentence( c, "%sGSV,1,1,00", talker );
+        return;
+    }
+    for (s = 0; s < total; s++) {
+        char  body[128];
+        int   len = sprintf( body, "%sGSV,%d,%d,%02d", talker, total, s+1, n );
+
+        for (i = s*4; i < n && i < s*4+4; i++) {
+            int  snr = svs[i].snr + rnd(rx, 5) - 2;
+            if (svs[i].snr == 0)
+                len += sprintf( body+len, ",%02d,%02d,%03d,", svs[i].prn,
+                                svs[i].elevation, svs[i].azimuth );
+            else
+                len += sprintf( body+len, ",%02d,%02d,%03d,%02d", svs[i].prn,
+                                svs[i].elevation, svs[i].azimuth, snr );
+        }
+        corpus_sentence( c, "%s", body );
+    }
+}
+
+
+static void
+make_svs( Receiver*  rx, Sv*  svs, int  n, int  first_prn )
+{
+    int  i;
+
+    for (i = 0; i < n; i++) {
+        svs[i].prn       = first_prn + i*3 % 32;
+        svs[i].elevation = 5 + rnd(rx, 85);
+        svs[i].azimuth   = rnd(rx, 360);
+        svs[i].snr       = 20 + rnd(rx, 30);
+    }
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       C O R P O R A                                   *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static void
+build_static( Corpus*  c, int  epochs )
+{
+    Receiver  rx[1];
+    Sv        svs[10];
+    int       e;
+
+    receiver_init( rx, 1 );
+    make_svs( rx, svs, 10, 1 );
+    for (e = 0; e < epochs; e++) {
+        emit_gga( c, "GP", rx, 10 );
+        emit_gsa( c, "GP", rx, svs, 10 );
+        emit_gsv( c, "GP", rx, svs, 10 );
+        emit_rmc( c, "GP", rx );
+        emit_vtg( c, "GP", rx );
+        receiver_move( rx );
+    }
+}
+
+
+static void
+build_urban( Corpus*  c, int  epochs )
+{
+    Receiver  rx[1];
+    Sv        svs[12];
+    int       visible = 8;
+    int       e, i;
+
+    receiver_init( rx, 2 );
+    make_svs( rx, svs, 12, 2 );
+    rx->speed  = 15.;
+    rx->course = 42.;
+    for (e = 0; e < epochs; e++) {
+        /* buildings come and go, with them satellites and the fix */
+        visible += rnd(rx, 5) - 2;
+        if (visible < 2)  visible = 2;
+        if (visible > 12) visible = 12;
+        rx->fix = visible >= 4;
+        for (i = 0; i < visible; i++)
+            svs[i].snr = rnd(rx, 8) ? 15 + rnd(rx, 25) : 0;
+
+        if (rnd(rx, 10) == 0)
+            rx->course = fmod( rx->course + 90., 360. );
+        rx->speed = 5. + rnd(rx, 200) / 10.;
+
+        emit_gga( c, "GP", rx, rx->fix ? visible : 0 );
+        emit_gll( c, "GP", rx );
+        emit_gsa( c, "GP", rx, svs, visible );
+        emit_gsv( c, "GP", rx, svs, visible );
+        emit_rmc( c, "GP", rx );
+        emit_vtg( c, "GP", rx );
+        receiver_move( rx );
+    }
+}
+
+
+static void
+build_multi_gnss( Corpus*  c, int  epochs )
+{
+    Receiver  rx[1];
+    Sv        gps[12], glo[8], gal[6], bds[6];
+    int       e;
+
+    receiver_init( rx, 3 );
+    make_svs( rx, gps, 12, 1 );
+    make_svs( rx, glo, 8, 65 );
+    make_svs( rx, gal, 6, 1 );
+    make_svs( rx, bds, 6, 1 );
+    rx->speed  = 30.;
+    rx->course = 270.;
+    for (e = 0; e < epochs; e++) {
+        char  t[24];
+
+        emit_gga( c, "GN", rx, 32 );
+        emit_gsa( c, "GN", rx, gps, 12 );
+        emit_gsa( c, "GN", rx, glo, 8 );
+        emit_gsa( c, "GN", rx, gal, 6 );
+        emit_gsa( c, "GN", rx, bds, 6 );
+        emit_gsv( c, "GP", rx, gps, 12 );
+        emit_gsv( c, "GL", rx, glo, 8 );
+        emit_gsv( c, "GA", rx, gal, 6 );
+        emit_gsv( c, "GB", rx, bds, 6 );
+        emit_rmc( c, "GN", rx );
+        emit_vtg( c, "GN", rx );
+        emit_zda( c, "GN", rx );
+
+        /* not understood by the parser, measures the rejection path */
+        format_time( t, rx->tod );
+        corpus_sentence( c, "GNGNS,%s,,,,,AAAA,32,0.6,,,,", t );
+        receiver_move( rx );
+    }
+}
+
+
+/* the urban trace, damaged the ways a noisy serial line does */
+static void
+build_corrupted( Corpus*  c, int  epochs )
+{
+    Corpus    clean[1];
+    Receiver  rx[1];
+    int       i;
+
+    memset( clean, 0, sizeof(clean) );
+    build_urban( clean, epochs );
+    if (corpus_index( clean ) < 0) {
+        corpus_free( clean );
+        return;
+    }
+
+    receiver_init( rx, 4 );
+    for (i = 0; i < clean->count; i++) {
+        char*  p   = clean->data + clean->lines[i];
+        int    len = (i+1 < clean->count ? clean->lines[i+1] : clean->len) - clean->lines[i];
+        int    roll = rnd(rx, 100);
+
+        if (roll < 5 && len > 8) {
+            /* flipped bit, the checksum no longer matches */
+            p[1 + rnd(rx, len-8)] ^= 0x04;
+            corpus_raw( c, p, len );
+        } else if (roll < 9) {
+            /* cut short */
+            corpus_raw( c, p, len/2 );
+            corpus_raw( c, "\r\n", 2 );
+        } else if (roll < 12 && len > 5) {
+            /* no checksum */
+            corpus_raw( c, p, len-5 );
+            corpus_raw( c, "\r\n", 2 );
+        } else if (roll < 15) {
+            /* binary garbage before the sentence */
+            char  junk[40];
+            int   n = 8 + rnd(rx, 32), k;
+            for (k = 0; k < n; k++)
+                junk[k] = 0x80 | rnd(rx, 128);
+            corpus_raw( c, junk, n );
+            corpus_raw( c, p, len );
+        } else if (roll < 17) {
+            /* longer than any valid sentence */
+            corpus_raw( c, p, len-2 );
+            corpus_raw( c, p+1, len-2 );
+            corpus_raw( c, "\r\n", 2 );
+        } else if (roll < 19) {
+            /* lost line feed, two sentences run together */
+            corpus_raw( c, p, len-2 );
+        } else
+            corpus_raw( c, p, len );
+    }
+    corpus_free( clean );
+}
+
+
+int
+corpus_build( Corpus*  c, int  which, int  epochs )
+{
+    static const char* const  names[CORPUS_COUNT] = {
+        "static", "urban", "multi-gnss", "corrupted"
+    };
+
+    memset( c, 0, sizeof(*c) );
+    c->name = names[which];
+
+    switch (which) {
+        case CORPUS_STATIC:     build_static( c, epochs ); break;
+        case CORPUS_URBAN:      build_urban( c, epochs ); break;
+        case CORPUS_MULTI_GNSS: build_multi_gnss( c, epochs ); break;
+        case CORPUS_CORRUPTED:  build_corrupted( c, epochs ); break;
+    }
+    if (c->len == 0 || corpus_index( c ) < 0) {
+        corpus_free( c );
+        return -1;
+    }
+    return 0;
+}
+
+
+int
+corpus_load( Corpus*  c, const char*  path )
+{
+    char  buf[4096];
+    int   fd, ret;
+
+    memset( c, 0, sizeof(*c) );
+    c->name = path;
+
+    fd = open( path, O_RDONLY );
+    if (fd < 0) {
+        fprintf( stderr, "could not open %s: %s\n", path, strerror(errno) );
+        return -1;
+    }
+    while ((ret = read( fd, buf, sizeof(buf) )) > 0)
+        corpus_raw( c, buf, ret );
+    close( fd );
+
+    if (ret < 0 || c->len == 0 || corpus_index( c ) < 0) {
+        fprintf( stderr, "could not read %s\n", path );
+        corpus_free( c );
+        return -1;
+    }
+    return 0;
+}
+
+
+void
+corpus_free( Corpus*  c )
+{
+    free( c->data );
+    free( c->lines );
+    c->data  = NULL;
+    c->lines = NULL;
+    c->len   = c->max = 0;
+    c->count = c->lines_max = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef _corpus_h
+#define _corpus_h
+
+/* a NMEA stream held in memory, with the offset of each line in it */
+typedef struct {
+    const char*  name;
+    char*        data;
+    int          len;
+    int          max;
+    int*         lines;         /* lines[i] is the offset of line i */
+    int          count;
+    int          lines_max;
+} Corpus;
+
+/* the corpora built into the benchmark */
+enum {
+    CORPUS_STATIC = 0,          /* parked receiver, GPS only, 10 satellites */
+    CORPUS_URBAN,               /* moving through an urban canyon, fix lost and regained */
+    CORPUS_MULTI_GNSS,          /* GPS, GLONASS, Galileo and BeiDou, GN solution */
+    CORPUS_CORRUPTED,           /* the urban trace with line noise */
+    CORPUS_COUNT
+};
+
+/* generate one of the built-in corpora, the output is the same on every run.
+ * returns -1 if out of memory.
+ */
+extern int
+corpus_build( Corpus*  c, int  which, int  epochs );
+
+/* load a NMEA log from a file instead, returns -1 on error */
+extern int
+corpus_load( Corpus*  c, const char*  path );
+
+extern void
+corpus_free( Corpus*  c );
+
+#endif /* _corpus_h */
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "nmea_framer.h"
+#include "nmea_parser.h"
+
+/* measures the cost of the NMEA path shared by the GPS backends: the
+ * framer, the tokenizer, the numeric decoders and nmea_reader_parse(),
+ * over built-in corpora or NMEA logs given on the command line.
+ *
+ *   nmeabench [-n passes] [-e epochs] [-c chunk] [file.nmea ...]
+ */
+
+#define  DEFAULT_PASSES  20
+#define  DEFAULT_EPOCHS  600
+#define  DEFAULT_CHUNK   64
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       A L L O C A T I O N S                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* the allocator is wrapped at link time, see Android.mk, so that any
+ * allocation made by the code under test shows up in the report.
+ */
+static unsigned  _allocs;
+
+extern void*  __real_malloc( size_t  size );
+extern void*  __real_calloc( size_t  count, size_t  size );
+extern void*  __real_realloc( void*  p, size_t  size );
+
+void*
+__wrap_malloc( size_t  size )
+{
+    _allocs += 1;
+    return __real_malloc( size );
+}
+
+void*
+__wrap_calloc( size_t  count, size_t  size )
+{
+    _allocs += 1;
+    return __real_calloc( count, size );
+}
+
+void*
+__wrap_realloc( void*  p, size_t  size )
+{
+    _allocs += 1;
+    return __real_realloc( p, size );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       T I M I N G                                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+static long long
+now_ns( void )
+{
+    struct timespec  ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* cost of a now_ns() pair, subtracted from per-sentence timings */
+static long long  _clock_overhead;
+
+static void
+calibrate_clock( void )
+{
+    long long  best = -1;
+    int        round, i;
+
+    for (round = 0; round < 5; round++) {
+        long long  start = now_ns();
+        for (i = 0; i < 100000; i++)
+            now_ns();
+        start = (now_ns() - start) / 100000;
+        if (best < 0 || start < best)
+            best = start;
+    }
+    _clock_overhead = best;
+}
+
+/* keeps the compiler from dropping the measured calls */
+static volatile double  _sink;
+
+static void
+print_rate( const char*  what, long long  ns, unsigned  count, const char*  unit )
+{
+    double  per = count ? (double)ns / count : 0.;
+
+    printf( "  %-22s %9.1f ns/%-8s %9.2fM %s/s\n",
+            what, per, unit, per > 0 ? 1000. / per : 0., unit );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       S E N T E N C E   T Y P E S                     *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+#define  MAX_TYPES  16
+
+typedef struct {
+    char       name[4];
+    unsigned   count;
+    long long  ns;
+} TypeStats;
+
+typedef struct {
+    NmeaReader   reader[1];
+    NmeaFramer   framer[1];
+    unsigned     sentences;
+    unsigned     epochs;
+    int          timed;         /* time each sentence by type */
+    TypeStats    types[ MAX_TYPES ];
+    int          num_types;
+} Bench;
+
+
+/* 'GGA' for '$GPGGA,...', '---' for anything the parser doesn't handle */
+static TypeStats*
+bench_type( Bench*  b, const char*  p, const char*  end )
+{
+    static const char  known[] = "GGA GLL GSA GSV RMC VTG ZDA ";
+    char  name[4] = "---";
+    int   i;
+
+    for (i = 0; known[i]; i += 4) {
+        if (end - p >= 6 && p[0] == '$' && !memcmp( p+3, known+i, 3 )) {
+            memcpy( name, p+3, 3 );
+            break;
+        }
+    }
+
+    for (i = 0; i < b->num_types; i++)
+        if (!memcmp( b->types[i].name, name, 4 ))
+            return &b->types[i];
+
+    if (b->num_types == MAX_TYPES)
+        return &b->types[MAX_TYPES-1];
+
+    memcpy( b->types[b->num_types].name, name, 4 );
+    return &b->types[b->num_types++];
+}
+
+
+static void
+bench_epoch( void*  opaque, NmeaReader*  r, int  what )
+{
+    Bench*  b = opaque;
+
+    if (what & NMEA_EPOCH_FIX) {
+        b->epochs += 1;
+        _sink += r->fix.latitude;
+    }
+}
+
+
+static void
+bench_sentence( void*  opaque, const char*  p, const char*  end )
+{
+    Bench*  b = opaque;
+
+    b->sentences += 1;
+    if (b->timed) {
+        TypeStats*  type  = bench_type( b, p, end );
+        long long   start = now_ns();
+
+        nmea_reader_parse( b->reader, p, end );
+        type->ns    += now_ns() - start - _clock_overhead;
+        type->count += 1;
+    } else
+        nmea_reader_parse( b->reader, p, end );
+}
+
+
+static void
+bench_reset( Bench*  b, int  timed )
+{
+    nmea_reader_init( b->reader );
+    nmea_reader_set_checksum_mode( b->reader, NMEA_CHECKSUM_VERIFY );
+    nmea_reader_set_callback( b->reader, bench_epoch, b );
+    nmea_framer_init( b->framer, bench_sentence, b );
+    b->sentences = 0;
+    b->epochs    = 0;
+    b->timed     = timed;
+}
+
+
+static void
+bench_feed( Bench*  b, const Corpus*  c, int  chunk )
+{
+    int  pos;
+
+    for (pos = 0; pos < c->len; pos += chunk)
+        nmea_framer_feed( b->framer, c->data + pos,
+                          c->len - pos < chunk ? c->len - pos : chunk );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       M E A S U R E M E N T S                         *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* framer and parser together, as the backends run them */
+static void
+measure_stream( Bench*  b, const Corpus*  c, int  passes, int  chunk )
+{
+    long long  ns = 0;
+    unsigned   allocs = _allocs;
+    int        pass;
+
+    for (pass = 0; pass < passes; pass++) {
+        long long  start;
+
+        bench_reset( b, 0 );
+        start = now_ns();
+        bench_feed( b, c, chunk );
+        ns += now_ns() - start;
+    }
+    allocs = _allocs - allocs;
+
+    printf( "%s: %d bytes, %u sentences, %u fixes, %u bad checksum, %u ignored\n",
+            c->name, c->len, b->sentences, b->epochs,
+            b->reader->stats.bad_checksum, b->reader->stats.ignored );
+    print_rate( "framer+parser", ns, b->sentences * passes, "sentence" );
+    printf( "  %-22s %9u\n", "allocations", allocs );
+}
+
+
+static int
+compare_types( const void*  a, const void*  b )
+{
+    return memcmp( ((const TypeStats*)a)->name, ((const TypeStats*)b)->name, 4 );
+}
+
+
+/* nmea_reader_parse() alone, per sentence type */
+static void
+measure_types( Bench*  b, const Corpus*  c, int  passes, int  chunk )
+{
+    TypeStats  types[ MAX_TYPES ];
+    int        num_types = 0;
+    int        pass, i;
+
+    memset( types, 0, sizeof(types) );
+    for (pass = 0; pass < passes; pass++) {
+        bench_reset( b, 1 );
+        memcpy( b->types, types, sizeof(types) );
+        b->num_types = num_types;
+        bench_feed( b, c, chunk );
+        memcpy( types, b->types, sizeof(types) );
+        num_types = b->num_types;
+    }
+
+    qsort( types, num_types, sizeof(types[0]), compare_types );
+    for (i = 0; i < num_types; i++) {
+        char  what[32];
+        snprintf( what, sizeof(what), "parse %.3s (%u)", types[i].name,
+                  types[i].count / passes );
+        print_rate( what, types[i].ns > 0 ? types[i].ns : 0, types[i].count, "sentence" );
+    }
+}
+
+
+/* the tokenizer with checksum verification, over every line */
+static void
+measure_tokenizer( const Corpus*  c, int  passes )
+{
+    NmeaTokenizer  tzer[1];
+    long long      start, ns;
+    unsigned       allocs = _allocs;
+    int            pass, i, tokens = 0;
+
+    start = now_ns();
+    for (pass = 0; pass < passes; pass++) {
+        for (i = 0; i < c->count; i++) {
+            const char*  p   = c->data + c->lines[i];
+            const char*  end = i+1 < c->count ? c->data + c->lines[i+1] : c->data + c->len;
+            tokens += nmea_tokenizer_init_checked( tzer, p, end, NMEA_CHECKSUM_VERIFY );
+        }
+    }
+    ns = now_ns() - start;
+    _sink += tokens;
+
+    print_rate( "tokenizer", ns, c->count * passes, "sentence" );
+    if (_allocs != allocs)
+        printf( "  %-22s %9u\n", "allocations", _allocs - allocs );
+}
+
+
+/* the fields of the GGA sentences, fed to each decoder in turn */
+static void
+measure_decoders( const Corpus*  c, int  passes )
+{
+    Token*      fields;
+    int         count = 0, pass, i;
+    long long   start, ns_time, ns_coord, ns_decimal;
+    unsigned    allocs;
+
+    fields = malloc( c->count * 4 * sizeof(Token) );
+    if (fields == NULL)
+        return;
+
+    for (i = 0; i < c->count; i++) {
+        NmeaTokenizer  tzer[1];
+        const char*    p   = c->data + c->lines[i];
+        const char*    end = i+1 < c->count ? c->data + c->lines[i+1] : c->data + c->len;
+
+        if (end - p < 7 || memcmp( p+3, "GGA", 3 ) ||
+            nmea_tokenizer_init_checked( tzer, p, end, NMEA_CHECKSUM_VERIFY ) < 10)
+            continue;
+        fields[count*4 + 0] = nmea_tokenizer_get( tzer, 1 );   /* time */
+        fields[count*4 + 1] = nmea_tokenizer_get( tzer, 2 );   /* latitude */
+        fields[count*4 + 2] = nmea_tokenizer_get( tzer, 4 );   /* longitude */
+        fields[count*4 + 3] = nmea_tokenizer_get( tzer, 9 );   /* altitude */
+        count += 1;
+    }
+    if (count == 0) {
+        free( fields );
+        return;
+    }
+
+    allocs = _allocs;
+    start  = now_ns();
+    for (pass = 0; pass < passes; pass++)
+        for (i = 0; i < count; i++)
+            _sink += nmea_decode_time( fields[i*4].p, fields[i*4].end );
+    ns_time = now_ns() - start;
+
+    start = now_ns();
+    for (pass = 0; pass < passes; pass++)
+        for (i = 0; i < count; i++) {
+            _sink += nmea_decode_coord( fields[i*4+1].p, fields[i*4+1].end );
+            _sink += nmea_decode_coord( fields[i*4+2].p, fields[i*4+2].end );
+        }
+    ns_coord = now_ns() - start;
+
+    start = now_ns();
+    for (pass = 0; pass < passes; pass++)
+        for (i = 0; i < count; i++) {
+            NmeaDecimal  d;
+            if (nmea_decimal_decode( fields[i*4+3].p, fields[i*4+3].end, &d ) == 0)
+                _sink += nmea_decimal_to_double( &d );
+        }
+    ns_decimal = now_ns() - start;
+    allocs = _allocs - allocs;
+
+    print_rate( "decode time", ns_time, count * passes, "field" );
+    print_rate( "decode coord", ns_coord, count * passes * 2, "field" );
+    print_rate( "decode decimal", ns_decimal, count * passes, "field" );
+    if (allocs != 0)
+        printf( "  %-22s %9u\n", "allocations", allocs );
+    free( fields );
+}
+
+
+static void
+run( const Corpus*  c, int  passes, int  chunk )
+{
+    Bench*  b = calloc( 1, sizeof(*b) );
+
+    if (b == NULL)
+        return;
+
+    measure_stream( b, c, passes, chunk );
+    measure_tokenizer( c, passes );
+    measure_decoders( c, passes );
+    measure_types( b, c, passes, chunk );
+    printf( "\n" );
+    free( b );
+}
+
+
+static void
+usage( void )
+{
+    fprintf( stderr, "usage: nmeabench [-n passes] [-e epochs] [-c chunk] [file.nmea ...]\n" );
+    exit( 1 );
+}
+
+
+int main(int argc, char *argv[])
+{
+    int  passes = DEFAULT_PASSES;
+    int  epochs = DEFAULT_EPOCHS;
+    int  chunk  = DEFAULT_CHUNK;
+    int  opt, i;
+
+    while ((opt = getopt( argc, argv, "n:e:c:" )) != -1) {
+        switch (opt) {
+            case 'n': passes = atoi( optarg ); break;
+            case 'e': epochs = atoi( optarg ); break;
+            case 'c': chunk  = atoi( optarg ); break;
+            default:  usage();
+        }
+    }
+    if (passes <= 0 || epochs <= 0 || chunk <= 0)
+        usage();
+
+    calibrate_clock();
+    printf( "%d passes, %d byte reads, clock overhead %lld ns\n\n",
+            passes, chunk, _clock_overhead );
+
+    if (optind < argc) {
+        for (i = optind; i < argc; i++) {
+            Corpus  c;
+            if (corpus_load( &c, argv[i] ) < 0)
+                return 1;
+            run( &c, passes, chunk );
+            corpus_free( &c );
+        }
+    } else {
+        for (i = 0; i < CORPUS_COUNT; i++) {
+            Corpus  c;
+            if (corpus_build( &c, i, epochs ) < 0) {
+                fprintf( stderr, "could not build corpus %d\n", i );
+                return 1;
+            }
+            run( &c, passes, chunk );
+            corpus_free( &c );
+        }
+    }
+    return 0;
+}
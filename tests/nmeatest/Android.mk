@@ -0,0 +1,23 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+# Checks of the NMEA parser on hand-written receiver output. Exits with a
+# non-zero status when a check fails.
+
+LOCAL_SRC_FILES:= \
+	nmeatest.c \
+	../../gps/nmea_framer.c \
+	../../gps/nmea_parser.c
+
+LOCAL_C_INCLUDES:= \
+	$(LOCAL_PATH)/../../gps
+
+LOCAL_SHARED_LIBRARIES:= liblog
+
+LOCAL_MODULE:= nmeatest
+
+LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
+
+LOCAL_MODULE_TAGS:= tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,219 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nmea_framer.h"
+#include "nmea_parser.h"
+
+/* checks of the NMEA parser on hand-written receiver output.
+ *
+ *   nmeatest
+ */
+
+#define  MAX_FIXES  16
+
+typedef struct {
+    NmeaReader   reader[1];
+    NmeaFramer   framer[1];
+    GpsUtcTime   fixes[ MAX_FIXES ];
+    int          num_fixes;
+    int          svs[ MAX_FIXES ];      /* num_svs of each SV publication */
+    int          num_svs;
+} Test;
+
+static int  _failures;
+
+static void
+test_epoch( void*  opaque, NmeaReader*  r, int  what )
+{
+    Test*  t = opaque;
+
+    if ((what & NMEA_EPOCH_FIX) && t->num_fixes < MAX_FIXES)
+        t->fixes[ t->num_fixes++ ] = r->fix.timestamp;
+    if ((what & NMEA_EPOCH_SV) && t->num_svs < MAX_FIXES)
+        t->svs[ t->num_svs++ ] = r->sv_ext.num_svs;
+}
+
+static void
+test_parse( void*  opaque, const char*  p, const char*  end )
+{
+    nmea_reader_parse( opaque, p, end );
+}
+
+static void
+test_init( Test*  t )
+{
+    memset( t, 0, sizeof(*t) );
+    nmea_reader_init( t->reader );
+    nmea_reader_set_checksum_mode( t->reader, NMEA_CHECKSUM_VERIFY );
+    nmea_reader_set_callback( t->reader, test_epoch, t );
+    nmea_framer_init( t->framer, test_parse, t->reader );
+}
+
+/* feed one sentence, given without '$' and checksum */
+static void
+test_sentence( Test*  t, const char*  format, ... )
+{
+    char     body[128], line[160];
+    va_list  args;
+    int      sum = 0, len;
+    char*    p;
+
+    va_start( args, format );
+    vsnprintf( body, sizeof(body), format, args );
+    va_end( args );
+
+    for (p = body; *p; p++)
+        sum ^= (unsigned char)*p;
+    len = snprintf( line, sizeof(line), "$%s*%02X\r\n", body, sum );
+    nmea_framer_feed( t->framer, line, len );
+}
+
+static void
+check( int  ok, const char*  name, const char*  format, ... )
+{
+    va_list  args;
+
+    printf( "%s %s", ok ? "PASS" : "FAIL", name );
+    if (!ok) {
+        printf( ": " );
+        va_start( args, format );
+        vprintf( format, args );
+        va_end( args );
+        _failures += 1;
+    }
+    printf( "\n" );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       D A T E   C H A N G E                           *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+/* 2024-12-31 00:00:00 UTC */
+#define  DAY_EPOCH  1735603200000LL
+
+static const struct {
+    const char*  time;
+    const char*  date;
+    GpsUtcTime   timestamp;
+} _midnight[] = {
+    { "235958.00", "311224", DAY_EPOCH + 86398000LL },
+    { "235959.00", "311224", DAY_EPOCH + 86399000LL },
+    { "000000.00", "010125", DAY_EPOCH + 86400000LL },
+    { "000001.00", "010125", DAY_EPOCH + 86401000LL },
+    { "000002.00", "010125", DAY_EPOCH + 86402000LL },
+};
+
+#define  MIDNIGHT_EPOCHS  (int)(sizeof(_midnight)/sizeof(_midnight[0]))
+
+static void
+test_gga( Test*  t, const char*  time )
+{
+    test_sentence( t, "GPGGA,%s,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,", time );
+}
+
+static void
+test_rmc( Test*  t, const char*  time, const char*  date )
+{
+    test_sentence( t, "GPRMC,%s,A,4807.038,N,01131.000,E,000.0,000.0,%s,,", time, date );
+}
+
+/* the timestamps of a fix sequence across midnight, with the date coming
+ * before or after the first time of the new day
+ */
+static void
+test_midnight( const char*  name, int  rmc_first )
+{
+    Test  t[1];
+    int   n;
+
+    test_init( t );
+    for (n = 0; n < MIDNIGHT_EPOCHS; n++) {
+        if (rmc_first) {
+            test_rmc( t, _midnight[n].time, _midnight[n].date );
+            test_gga( t, _midnight[n].time );
+        } else {
+            test_gga( t, _midnight[n].time );
+            test_rmc( t, _midnight[n].time, _midnight[n].date );
+        }
+    }
+    /* until the end of an epoch is learned, it is only complete once the
+     * next one starts
+     */
+    test_gga( t, "000003.00" );
+
+    if (t->num_fixes < MIDNIGHT_EPOCHS) {
+        check( 0, name, "%d fixes, expected %d", t->num_fixes, MIDNIGHT_EPOCHS );
+        return;
+    }
+    for (n = 0; n < MIDNIGHT_EPOCHS; n++) {
+        if (t->fixes[n] != _midnight[n].timestamp) {
+            check( 0, name, "fix at %s: timestamp %lld, expected %lld", _midnight[n].time,
+                   (long long)t->fixes[n], (long long)_midnight[n].timestamp );
+            return;
+        }
+    }
+    check( 1, name, NULL );
+}
+
+/*****************************************************************/
+/*****************************************************************/
+/*****                                                       *****/
+/*****       S A T E L L I T E S                             *****/
+/*****                                                       *****/
+/*****************************************************************/
+/*****************************************************************/
+
+#define  GSV_EPOCHS  3
+
+/* GPS and GLONASS cycles make one table per epoch, whether they come
+ * before the epoch's last sentence or after it
+ */
+static void
+test_gsv_talkers( const char*  name, int  gsv_last )
+{
+    static const char*  times[ GSV_EPOCHS ] = { "120000.00", "120001.00", "120002.00" };
+    Test  t[1];
+    int   n;
+
+    test_init( t );
+    for (n = 0; n < GSV_EPOCHS; n++) {
+        test_gga( t, times[n] );
+        if (gsv_last)
+            test_rmc( t, times[n], "311224" );
+        test_sentence( t, "GPGSA,A,3,04,05,09,,,,,,,,,,2.5,1.3,2.1" );
+        test_sentence( t, "GPGSV,1,1,03,04,40,083,46,05,17,308,41,09,07,344,39" );
+        test_sentence( t, "GLGSV,1,1,02,65,40,083,46,66,17,308,41" );
+        if (!gsv_last)
+            test_rmc( t, times[n], "311224" );
+    }
+    /* publishes the cycles that came after the last epoch */
+    test_gga( t, "120003.00" );
+
+    if (t->num_svs != GSV_EPOCHS) {
+        check( 0, name, "%d tables, expected %d", t->num_svs, GSV_EPOCHS );
+        return;
+    }
+    for (n = 0; n < GSV_EPOCHS; n++) {
+        if (t->svs[n] != 5) {
+            check( 0, name, "table %d has %d satellites, expected 5", n, t->svs[n] );
+            return;
+        }
+    }
+    check( 1, name, NULL );
+}
+
+int
+main( void )
+{
+    test_midnight( "midnight, RMC first", 1 );
+    test_midnight( "midnight, GGA first", 0 );
+    test_gsv_talkers( "GP+GL GSV, before RMC", 0 );
+    test_gsv_talkers( "GP+GL GSV, after RMC", 1 );
+
+    return _failures ? 1 : 0;
+}